@@ -0,0 +1,48 @@
+#include "include/AgentStats.h"
+
+static const uint32_t bucketLimits[SNMP_LATENCY_BUCKETS] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, UINT32_MAX
+};
+
+uint32_t SNMPLatencyHistogram::bucketLimit(int bucket){
+    return bucketLimits[bucket];
+}
+
+void SNMPLatencyHistogram::record(uint32_t micros){
+    int bucket = 0;
+    while(micros > bucketLimits[bucket]) bucket++;
+
+    buckets[bucket]++;
+    count++;
+    if(micros > max) max = micros;
+}
+
+uint32_t SNMPLatencyHistogram::percentile(unsigned int percent) const {
+    if(!count) return 0;
+
+    // The smallest number of samples that has to be at or below the answer, rounded up
+    uint64_t wanted = ((uint64_t)count * percent + 99) / 100;
+    if(!wanted) wanted = 1;
+
+    uint64_t seen = 0;
+    for(int bucket = 0; bucket < SNMP_LATENCY_BUCKETS; bucket++){
+        seen += buckets[bucket];
+        if(seen >= wanted){
+            // Nothing was slower than max, so it's a tighter answer for the top buckets
+            return bucketLimits[bucket] < max ? bucketLimits[bucket] : max;
+        }
+    }
+    return max;
+}
+
+void SNMPAgentStats::countErrorStatus(int errorStatus, bool outgoing){
+    // Only the SNMPv1 errors have counters, the v2 ones were left out of RFC 3418
+    switch(errorStatus){
+        case TOO_BIG: count(outgoing ? SNMP_OUT_TOO_BIGS : SNMP_IN_TOO_BIGS); break;
+        case NO_SUCH_NAME: count(outgoing ? SNMP_OUT_NO_SUCH_NAMES : SNMP_IN_NO_SUCH_NAMES); break;
+        case BAD_VALUE: count(outgoing ? SNMP_OUT_BAD_VALUES : SNMP_IN_BAD_VALUES); break;
+        case READ_ONLY: if(!outgoing) count(SNMP_IN_READ_ONLYS); break;
+        case GEN_ERR: count(outgoing ? SNMP_OUT_GEN_ERRS : SNMP_IN_GEN_ERRS); break;
+        default: break;
+    }
+}
@@ -0,0 +1,83 @@
+#include "include/AllocStats.h"
+
+#ifdef COMPILING_TESTS
+
+#include <string.h>
+
+// Plain data only, so none of these need constructing before the first allocation can be counted
+static thread_local SNMPAllocStats stats;
+static thread_local SNMPAllocCount total;
+static thread_local SNMP_ALLOC_PHASE currentPhase = SNMP_ALLOC_OUTSIDE;
+
+SNMPAllocStats& snmp_alloc_stats(){
+    return stats;
+}
+
+void snmp_alloc_stats_reset(){
+    memset(&stats, 0, sizeof(stats));
+}
+
+void snmp_alloc_record(size_t bytes){
+    stats.phases[currentPhase].allocations++;
+    stats.phases[currentPhase].bytes += bytes;
+    total.allocations++;
+    total.bytes += bytes;
+}
+
+SNMPAllocPhase::SNMPAllocPhase(SNMP_ALLOC_PHASE phase): previous(currentPhase){
+    currentPhase = phase;
+}
+
+SNMPAllocPhase::~SNMPAllocPhase(){
+    currentPhase = previous;
+}
+
+SNMPAllocRequest::SNMPAllocRequest(): start(total){}
+
+SNMPAllocRequest::~SNMPAllocRequest(){
+    if(pduType < ASN_PDU_TYPE_MIN_VALUE || pduType > ASN_PDU_TYPE_MAX_VALUE) return;
+
+    int index = pduType - ASN_PDU_TYPE_MIN_VALUE;
+    stats.pduTypes[index].allocations += total.allocations - start.allocations;
+    stats.pduTypes[index].bytes += total.bytes - start.bytes;
+    stats.requests[index]++;
+}
+
+#ifdef SNMP_ALLOC_STATS
+#ifndef __GLIBC__
+#error "SNMP_ALLOC_STATS counts allocations by hooking glibc's malloc"
+#endif
+// ASan's free() doesn't know about glibc's heap, so the hooks can't work under it (gcc says so with __SANITIZE_ADDRESS__, clang with __has_feature)
+#if defined(__SANITIZE_ADDRESS__)
+#error "SNMP_ALLOC_STATS can't be used under ASan"
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#error "SNMP_ALLOC_STATS can't be used under ASan"
+#endif
+#endif
+
+// Everything, operator new included, ends up in one of these. Hooking here rather than operator new also catches
+// the calloc()s some of the types use, and leaves operator new free for anything else that wants to replace it
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+
+    void* malloc(size_t size){
+        snmp_alloc_record(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size){
+        snmp_alloc_record(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size){
+        snmp_alloc_record(size);
+        return __libc_realloc(ptr, size);
+    }
+}
+#endif
+
+#endif
@@ -15,61 +15,62 @@ static size_t decode_ber_longform_integer(const uint8_t* buf, long* decoded_inte
     return i;
 }
 
-static size_t decode_ber_length_integer(const uint8_t* buf, int* decoded_integer, int){
-    if(*buf <= 127) {
-        *decoded_integer = *buf;
-        return 1;
-    } else {
-        int numBytes = *buf & 0x7F;
-        int special_length = 0;
-        for(int k = 0; k < numBytes; k++){
-            buf++;
-            special_length <<= 8;
-            special_length |= *buf;
-        }
-        *decoded_integer = special_length;
-        return numBytes + 1;
+int decode_ber_header(const uint8_t* buf, size_t max_len, ASN_TYPE* type, size_t* length){
+    if(max_len < 2) return SNMP_BUFFER_ERROR_TLV_TOO_SMALL;
+
+    *type = (ASN_TYPE)buf[0];
+    if(buf[1] <= 127){
+        *length = buf[1];
+        if(*length + 2 > max_len) return SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED;
+        return 2;
+    }
+
+    // Senders may pad the length out with leading zero bytes, so anything up to what a size_t holds is read,
+    // and it's the value rather than the number of bytes that has to fit in what we were given
+    size_t numBytes = buf[1] & 0x7F;
+    if(numBytes == 0 || numBytes > sizeof(size_t)) return SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED;
+    if(numBytes + 2 > max_len) return SNMP_BUFFER_ERROR_TLV_TOO_SMALL;
+
+    *length = 0;
+    for(size_t k = 0; k < numBytes; k++){
+        *length <<= 8;
+        *length |= buf[2 + k];
     }
+    if(*length > max_len - numBytes - 2) return SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED;
+    return numBytes + 2;
 }
 
 int BER_CONTAINER::fromBuffer(const uint8_t *buf, size_t max_len) {
-    // In the base class we are going to double check our type, and decode the length of this structure, then return bytes read
-    if(max_len < 2) return SNMP_BUFFER_ERROR_TLV_TOO_SMALL; // Too small for any type
-
-    const uint8_t* ptr = buf;
-    if(*ptr != _type){
-        SNMP_LOGE("Mismatched type when decoding %d, %d\n", _type, *ptr);
+    // In the base class we are going to double check our type, and decode the length of this structure, then return bytes read.
+    // Everything after this can read the whole value without checking
+    ASN_TYPE type;
+    size_t length;
+    int i = decode_ber_header(buf, max_len, &type, &length);
+    CHECK_DECODE_ERR(i);
+    if(type != _type){
+        SNMP_LOGE("Mismatched type when decoding %d, %d\n", _type, type);
         return SNMP_BUFFER_ERROR_TYPE_MISMATCH;
     }
-    ptr++; // type
-    ptr += decode_ber_length_integer(ptr, &_length, max_len);
-    if((size_t)_length + 2 > max_len){
-        // length of object is too big to read in
-        return SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED;
-    }
-
-    return ptr - buf;
+    _length = length;
+    return i;
 }
 
 int NetworkAddress::fromBuffer(const uint8_t *buf, size_t max_len){
     int i = BER_CONTAINER::fromBuffer(buf, max_len);
     CHECK_DECODE_ERR(i);
-    const uint8_t* ptr = buf + i;
-
-    // byte tempAddress[4];
-    // tempAddress[0] = *ptr++;
-    // tempAddress[1] = *ptr++;
-    // tempAddress[2] = *ptr++;
-    // tempAddress[3] = *ptr++;
+    if(_length != 4) return SNMP_BUFFER_ERROR_INVALID_LENGTH;
 
-    _value = IPAddress(ptr);
-    return ptr - buf;
+    _value = IPAddress(buf + i);
+    return _length + i;
 }
 
 int IntegerType::fromBuffer(const uint8_t *buf, size_t max_len){
     int i = BER_CONTAINER::fromBuffer(buf, max_len);
     CHECK_DECODE_ERR(i);
+    // Unsigned types can need a 5th byte to keep the top bit clear, which can only ever be a leading 0
+    if(_length < 1 || _length > 5) return SNMP_BUFFER_ERROR_INVALID_LENGTH;
     const uint8_t* ptr = buf + i;
+    if(_length == 5 && *ptr != 0x00) return SNMP_BUFFER_ERROR_INVALID_LENGTH;
 
     unsigned short tempLength = _length;
     uint32_t tempVal = 0; 
@@ -128,7 +129,7 @@ int OIDType::fromBuffer(const uint8_t *buf, size_t max_len){
     CHECK_DECODE_ERR(j);
     const uint8_t* dataPtr = buf + j;
 
-    if(*dataPtr != 0x2b) return SNMP_BUFFER_ERROR_INVALID_OID;
+    if(_length < 1 || *dataPtr != 0x2b) return SNMP_BUFFER_ERROR_INVALID_OID;
     this->data.reserve(_length);
     this->data.assign(dataPtr, dataPtr + _length);
     this->valid = true;
@@ -136,40 +137,76 @@ int OIDType::fromBuffer(const uint8_t *buf, size_t max_len){
     return _length + j;
 }
 
-static inline void long_to_buf(char* buf, long l, short r = 0){
-    if (l > 9){
-        long_to_buf(buf++, l / 10L, r + 1);
-    }
-    *buf++ = l % 10 + '0';
-    if(!r) *buf = 0;
+// Writes l out in decimal, terminated, returns how many digits that was
+static inline size_t long_to_buf(char* buf, unsigned long l){
+    char digits[24];
+    size_t count = 0;
+    do {
+        digits[count++] = l % 10 + '0';
+        l /= 10;
+    } while(l);
+
+    for(size_t i = 0; i < count; i++) buf[i] = digits[count - 1 - i];
+    buf[count] = 0;
+    return count;
 }
 
-const std::string& OIDType::string() {
-    if(!this->_value.length()){
-        const uint8_t* dataPtr = this->data.data();
-
-        this->_value = ".1.3";
-        if(!this->valid) return this->_value;
-
-        dataPtr++;
-
-        int i = this->data.size() - 1;
-        char buffer[16];
+// Writes out as much of the OID as fits in buf (always terminated), returns how many characters that was
+static size_t format_oid(const std::vector<uint8_t>& data, bool valid, char* buf, size_t max_len){
+    const char* truncated = "...";
+    size_t length = 0;
+    buf[0] = 0;
+    if(max_len < 5) return 0;
+    memcpy(buf, ".1.3", 5);
+    length = 4;
+    if(!valid) return length;
 
-        while(i > 0){
-            memset(buffer, 0, sizeof(buffer));
-            long item = 0;
-            int itemLength = decode_ber_longform_integer(dataPtr, &item, i);
-            dataPtr += itemLength; i -= itemLength;
+    const uint8_t* dataPtr = data.data() + 1;
+    int i = data.size() - 1;
+    char item[24];
 
-            buffer[0] = '.';
-            long_to_buf(buffer+1, item);
-            this->_value.append(buffer);
+    while(i > 0){
+        long value = 0;
+        int itemLength = decode_ber_longform_integer(dataPtr, &value, i);
+        if(itemLength <= 0) break;
+        dataPtr += itemLength; i -= itemLength;
+
+        item[0] = '.';
+        size_t arcLength = long_to_buf(item + 1, value) + 1;
+        if(length + arcLength >= max_len){
+            if(length + 4 > max_len) length = max_len - 4;
+            memcpy(buf + length, truncated, 4);
+            return length + 3;
         }
+        memcpy(buf + length, item, arcLength + 1);
+        length += arcLength;
+    }
+    return length;
+}
+
+const std::string& OIDType::string() {
+    if(!this->_value.length()){
+        // Every byte carries at most 7 bits of an arc, so no arc is more than 3 digits and a dot per byte
+        this->_value.resize(4 * this->data.size() + 5);
+        size_t length = format_oid(this->data, this->valid, &this->_value[0], this->_value.size());
+        this->_value.resize(length);
     }
     return this->_value;
 }
 
+OIDString OIDType::format() const {
+    OIDString formatted;
+    if(this->_value.length()){
+        size_t length = std::min(this->_value.length(), sizeof(formatted.value) - 1);
+        memcpy(formatted.value, this->_value.data(), length);
+        formatted.value[length] = 0;
+        if(length < this->_value.length()) memcpy(formatted.value + length - 3, "...", 3);
+    } else {
+        format_oid(this->data, this->valid, formatted.value, sizeof(formatted.value));
+    }
+    return formatted;
+}
+
 const std::vector<unsigned long> SortableOIDType::generateSortingMap() const {
     auto map = std::vector<unsigned long>();
 
@@ -191,14 +228,17 @@ const std::vector<unsigned long> SortableOIDType::generateSortingMap() const {
     return map;
 }
 
-int NullType::fromBuffer(const uint8_t *, size_t){
-    _length = 0;
-    return 2;
+int NullType::fromBuffer(const uint8_t *buf, size_t max_len){
+    int i = BER_CONTAINER::fromBuffer(buf, max_len);
+    CHECK_DECODE_ERR(i);
+    if(_length != 0) return SNMP_BUFFER_ERROR_INVALID_LENGTH;
+    return i;
 }
 
 int Counter64::fromBuffer(const uint8_t *buf, size_t max_len){
     int i = BER_CONTAINER::fromBuffer(buf, max_len);
     CHECK_DECODE_ERR(i);
+    if(_length < 1 || _length > 9) return SNMP_BUFFER_ERROR_INVALID_LENGTH;
     const uint8_t* ptr = buf + i;
 
     int tempLength = _length;
@@ -263,32 +303,62 @@ std::shared_ptr<BER_CONTAINER> ComplexType::createObjectForType(ASN_TYPE valueTy
     }
 }
 
+static inline bool is_complex_type(ASN_TYPE type){
+    return type == STRUCTURE || (type >= ASN_PDU_TYPE_MIN_VALUE && type <= ASN_PDU_TYPE_MAX_VALUE);
+}
+
 int ComplexType::fromBuffer(const uint8_t *buf, size_t max_len){
     int j = BER_CONTAINER::fromBuffer(buf, max_len);
     CHECK_DECODE_ERR(j);
-    const uint8_t* ptr = buf + j;
 
-    size_t i = 1;
-    while(i < (size_t)_length && i <= max_len){
-        ASN_TYPE valueType = (ASN_TYPE)*ptr;
+    // Nested structures don't recurse, each one is pushed onto this and its children read until we reach its end.
+    // Children can only use what's left of their parent's value, not whatever comes after it
+    struct {
+        ComplexType* container;
+        size_t end;
+    } open[SNMP_MAX_DECODE_DEPTH];
+    int depth = 0;
+    open[0].container = this;
+    open[0].end = j + _length;
+
+    size_t i = j;
+    while(depth >= 0){
+        if(i == open[depth].end){
+            depth--;
+            continue;
+        }
 
+        ASN_TYPE valueType = (ASN_TYPE)buf[i];
         auto newObj = ComplexType::createObjectForType(valueType);
         if(!newObj){
             SNMP_LOGD("Couldn't create object of type: %d\n", valueType);
-            return SNMP_BUFFER_ERROR_UNKNOWN_TYPE;
+            return depth == 0 ? SNMP_BUFFER_ERROR_UNKNOWN_TYPE : SNMP_BUFFER_ERROR_PROBLEM_DESERIALISING;
         }
 
-        int used_length = newObj->fromBuffer(ptr, max_len - i);
+        int used_length;
+        if(is_complex_type(valueType)){
+            if(depth + 1 >= SNMP_MAX_DECODE_DEPTH){
+                SNMP_LOGW("Structure nested more than %d deep\n", SNMP_MAX_DECODE_DEPTH);
+                return SNMP_BUFFER_ERROR_TOO_DEEP;
+            }
+            // Only the header for now, its children get read as we carry on
+            used_length = newObj->BER_CONTAINER::fromBuffer(buf + i, open[depth].end - i);
+        } else {
+            used_length = newObj->fromBuffer(buf + i, open[depth].end - i);
+        }
         if(used_length < 0){
             // Problem de-serialising
             SNMP_LOGD("Problem deserialising structure of type: %d\n", valueType);
             return SNMP_BUFFER_ERROR_PROBLEM_DESERIALISING;
         }
 
-        addValueToList(newObj);
-
-        ptr += used_length; 
+        open[depth].container->addValueToList(newObj);
         i += used_length;
+        if(is_complex_type(valueType)){
+            depth++;
+            open[depth].container = static_cast<ComplexType*>(newObj.get());
+            open[depth].end = i + newObj->_length;
+        }
     }
     return _length + j;
-}
\ No newline at end of file
+}
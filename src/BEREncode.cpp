@@ -34,7 +34,7 @@ static size_t encode_ber_length_integer(uint8_t* buf, size_t integer, int){
     return bytes_used;
 }
 
-static size_t encode_ber_length_integer_count(size_t integer){
+size_t encode_ber_length_integer_count(size_t integer){
     int bytes_used = 1;
     if(integer >= 128){
         if(integer >= 256){
@@ -46,6 +46,58 @@ static size_t encode_ber_length_integer_count(size_t integer){
     return bytes_used;
 }
 
+int encode_ber_header(uint8_t* buf, size_t max_len, ASN_TYPE type, size_t length){
+    if(max_len < 2) return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+    size_t header_length = 1 + encode_ber_length_integer_count(length);
+    if(max_len < header_length + length) return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+
+    *buf = type;
+    encode_ber_length_integer(buf + 1, length, max_len - 1);
+    return header_length;
+}
+
+int encode_ber_integer(uint8_t* buf, size_t max_len, ASN_TYPE type, uint32_t value){
+    // Integers are always written out as 4 bytes
+    int i = encode_ber_header(buf, max_len, type, 4);
+    CHECK_ENCODE_ERR(i);
+    uint8_t *ptr = buf + i;
+
+    *ptr++ = value >> 24 & 0xFF;
+    *ptr++ = value >> 16 & 0xFF;
+    *ptr++ = value >> 8 & 0xFF;
+    *ptr++ = value & 0xFF;
+
+    return ptr - buf;
+}
+
+int encode_ber_counter64(uint8_t* buf, size_t max_len, uint64_t value){
+    int i = encode_ber_header(buf, max_len, COUNTER64, 8);
+    CHECK_ENCODE_ERR(i);
+    uint8_t *ptr = buf + i;
+
+    *ptr++ = value >> 56 & 0xFF;
+    *ptr++ = value >> 48 & 0xFF;
+    *ptr++ = value >> 40 & 0xFF;
+    *ptr++ = value >> 32 & 0xFF;
+    *ptr++ = value >> 24 & 0xFF;
+    *ptr++ = value >> 16 & 0xFF;
+    *ptr++ = value >> 8 & 0xFF;
+    *ptr++ = value & 0xFF;
+
+    return ptr - buf;
+}
+
+int encode_ber_octets(uint8_t* buf, size_t max_len, ASN_TYPE type, const uint8_t* data, size_t length){
+    int i = encode_ber_header(buf, max_len, type, length);
+    CHECK_ENCODE_ERR(i);
+    uint8_t *ptr = buf + i;
+
+    memcpy(ptr, data, length);
+    ptr += length;
+
+    return ptr - buf;
+}
+
 int BER_CONTAINER::serialise(uint8_t* buf, size_t max_len){
     if(max_len < 2) return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
     *buf = _type;
@@ -53,11 +105,7 @@ int BER_CONTAINER::serialise(uint8_t* buf, size_t max_len){
 }
 
 int BER_CONTAINER::serialise(uint8_t* buf, size_t max_len, size_t known_length){
-    int i = BER_CONTAINER::serialise(buf, max_len);
-    CHECK_ENCODE_ERR(i);
-    i += encode_ber_length_integer(buf+i, known_length, max_len - i);
-    if(max_len < known_length + i) return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
-    return i;
+    return encode_ber_header(buf, max_len, _type, known_length);
 }
 
 int NetworkAddress::serialise(uint8_t* buf, size_t max_len){
@@ -74,33 +122,11 @@ int NetworkAddress::serialise(uint8_t* buf, size_t max_len){
 }
 
 int IntegerType::serialise(uint8_t* buf, size_t max_len){
-    int i = BER_CONTAINER::serialise(buf, max_len, 4);
-    CHECK_ENCODE_ERR(i);
-    uint8_t *ptr = buf + i;
-
-    *ptr++ = _value >> 24 & 0xFF;
-    *ptr++ = _value >> 16 & 0xFF;
-    *ptr++ = _value >> 8 & 0xFF;
-    *ptr++ = _value & 0xFF;
-    
-    return ptr - buf;
+    return encode_ber_integer(buf, max_len, _type, _value);
 }
 
 int Counter64::serialise(uint8_t* buf, size_t max_len){
-    int i = BER_CONTAINER::serialise(buf, max_len, 8);
-    CHECK_ENCODE_ERR(i);
-    uint8_t *ptr = buf + i;
-
-    *ptr++ = _value >> 56 & 0xFF;
-    *ptr++ = _value >> 48 & 0xFF;
-    *ptr++ = _value >> 40 & 0xFF;
-    *ptr++ = _value >> 32 & 0xFF;
-    *ptr++ = _value >> 24 & 0xFF;
-    *ptr++ = _value >> 16 & 0xFF;
-    *ptr++ = _value >> 8 & 0xFF;
-    *ptr++ = _value & 0xFF;
-    
-    return ptr - buf;
+    return encode_ber_counter64(buf, max_len, _value);
 }
 
 int NullType::serialise(uint8_t* buf, size_t max_len){
@@ -109,25 +135,11 @@ int NullType::serialise(uint8_t* buf, size_t max_len){
 
 
 int OctetType::serialise(uint8_t* buf, size_t max_len){
-    int i = BER_CONTAINER::serialise(buf, max_len, _value.length());
-    CHECK_ENCODE_ERR(i);
-    uint8_t *ptr = buf + i;
-
-    memcpy(ptr, _value.data(), _value.length());
-    ptr += _value.length();
-
-    return ptr - buf;
+    return encode_ber_octets(buf, max_len, _type, (const uint8_t*)_value.data(), _value.length());
 }
 
 int OpaqueType::serialise(uint8_t* buf, size_t max_len){
-    int i = BER_CONTAINER::serialise(buf, max_len, _dataLength);
-    CHECK_ENCODE_ERR(i);
-    uint8_t *ptr = buf + i;
-
-    memcpy(ptr, _value, _dataLength);
-    ptr += _dataLength;
-
-    return ptr - buf;
+    return encode_ber_octets(buf, max_len, _type, _value, _dataLength);
 }
 
 int OIDType::serialise(uint8_t* buf, size_t max_len){
@@ -0,0 +1,146 @@
+#include "include/HandlerRegistry.h"
+
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
+    #include <thread>
+    #define snmp_yield() std::this_thread::yield()
+#else
+    #include <Arduino.h>
+    #define snmp_yield() yield()
+#endif
+
+SNMP_REGISTRY_THREAD_LOCAL SNMPHandlerRegistry::Reader* SNMPHandlerRegistry::Reader::innermost = nullptr;
+
+SNMPHandlerRegistry::SNMPHandlerRegistry(): current(new std::deque<ValueCallback*>()), epoch(0){
+    readers[0] = 0;
+    readers[1] = 0;
+}
+
+SNMPHandlerRegistry::SNMPHandlerRegistry(const SNMPHandlerRegistry& other): SNMPHandlerRegistry(){
+    *this = other;
+}
+
+SNMPHandlerRegistry& SNMPHandlerRegistry::operator=(const SNMPHandlerRegistry& other){
+    if(this == &other) return *this;
+
+    other.lockWriter();
+    std::deque<ValueCallback*> copy = *other.current.load();
+    copy.insert(copy.end(), other.pending.begin(), other.pending.end());
+    other.unlockWriter();
+
+    lockWriter();
+    pending.clear();
+    std::deque<ValueCallback*>* changed = beginChange();
+    *changed = copy;
+    commitChange(changed);
+    unlockWriter();
+    return *this;
+}
+
+SNMPHandlerRegistry::~SNMPHandlerRegistry(){
+    delete current.load();
+}
+
+SNMPHandlerRegistry::Reader::Reader(SNMPHandlerRegistry& registry): registry(registry){
+    // If a writer moves the epoch on between reading it and counting ourselves in, it might not have seen us, so try again
+    while(true){
+        this->epoch = registry.epoch.load();
+        registry.readers[this->epoch & 1]++;
+        if(registry.epoch.load() == this->epoch) break;
+        registry.readers[this->epoch & 1]--;
+    }
+    this->snapshot = registry.current.load();
+
+    this->outer = innermost;
+    innermost = this;
+}
+
+SNMPHandlerRegistry::Reader::~Reader(){
+    // Readers are scoped, so they're always released innermost first
+    innermost = this->outer;
+    registry.readers[this->epoch & 1]--;
+}
+
+void SNMPHandlerRegistry::lockWriter() const {
+    while(writing.test_and_set(std::memory_order_acquire)){
+        snmp_yield();
+    }
+}
+
+void SNMPHandlerRegistry::unlockWriter() const {
+    writing.clear(std::memory_order_release);
+}
+
+bool SNMPHandlerRegistry::readingOnThisThread() const {
+    for(const Reader* reader = Reader::innermost; reader; reader = reader->outer){
+        if(&reader->registry == this) return true;
+    }
+    return false;
+}
+
+std::deque<ValueCallback*>* SNMPHandlerRegistry::beginChange(){
+#ifdef SNMP_THREADED
+    std::deque<ValueCallback*>* changed = new std::deque<ValueCallback*>(*current.load());
+#else
+    std::deque<ValueCallback*>* changed = current.load();
+#endif
+    changed->insert(changed->end(), pending.begin(), pending.end());
+    pending.clear();
+    return changed;
+}
+
+void SNMPHandlerRegistry::commitChange(std::deque<ValueCallback*>* changed){
+#ifdef SNMP_THREADED
+    std::deque<ValueCallback*>* old = current.exchange(changed);
+
+    // Anyone counted against the old parity might be holding the old snapshot, anyone after the flip sees the new one
+    unsigned int previous = epoch.fetch_add(1);
+    while(readers[previous & 1].load() != 0){
+        snmp_yield();
+    }
+
+    delete old;
+#else
+    (void)changed;
+#endif
+}
+
+void SNMPHandlerRegistry::add(ValueCallback* callback){
+    lockWriter();
+    pending.push_back(callback);
+    unlockWriter();
+}
+
+bool SNMPHandlerRegistry::remove(ValueCallback* callback){
+    if(readingOnThisThread()){
+        SNMP_LOGE("Can't remove a handler while this thread is reading the handlers\n");
+        return false;
+    }
+    lockWriter();
+    std::deque<ValueCallback*>* changed = beginChange();
+    bool removed = remove_handler(*changed, callback);
+    commitChange(changed);
+    unlockWriter();
+    return removed;
+}
+
+bool SNMPHandlerRegistry::sort(){
+    if(readingOnThisThread()){
+        SNMP_LOGE("Can't sort the handlers while this thread is reading them\n");
+        return false;
+    }
+    lockWriter();
+    std::deque<ValueCallback*>* changed = beginChange();
+    sort_handlers(*changed);
+    commitChange(changed);
+    unlockWriter();
+    return true;
+}
+
+bool SNMPHandlerRegistry::publish(){
+    if(readingOnThisThread()) return false;
+    lockWriter();
+    bool published = !pending.empty();
+    if(published) commitChange(beginChange());
+    unlockWriter();
+    return published;
+}
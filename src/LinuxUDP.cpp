@@ -0,0 +1,192 @@
+#include "LinuxUDP.h"
+
+#ifdef SNMP_LINUX_UDP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+LinuxUDP::LinuxUDP(unsigned int batchSize): batchSize(batchSize ? batchSize : 1),
+    rxBuffers(this->batchSize * MAX_SNMP_PACKET_LENGTH), rxMessages(this->batchSize), rxVecs(this->batchSize), rxAddresses(this->batchSize),
+    txBuffers(this->batchSize * MAX_SNMP_PACKET_LENGTH), txMessages(this->batchSize), txVecs(this->batchSize), txAddresses(this->batchSize){
+}
+
+LinuxUDP::~LinuxUDP(){
+    stop();
+}
+
+void LinuxUDP::begin(int port){
+    if(sockfd >= 0) stop();
+
+    sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if(sockfd < 0){
+        SNMP_LOGW("Failed to create socket: %d\n", errno);
+        return;
+    }
+
+    int enable = 1;
+    if(reusePort && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0){
+        SNMP_LOGW("Failed to set SO_REUSEPORT: %d\n", errno);
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if(bind(sockfd, (const struct sockaddr*)&address, sizeof(address)) < 0){
+        SNMP_LOGW("Failed to bind to port %d: %d\n", port, errno);
+        close(sockfd);
+        sockfd = -1;
+    }
+}
+
+void LinuxUDP::stop(){
+    if(sockfd < 0) return;
+
+    flush();
+    close(sockfd);
+    sockfd = -1;
+    rxCount = rxIndex = 0;
+}
+
+int LinuxUDP::parsePacket(){
+    if(batchPending()){
+        rxIndex++;
+    } else {
+        // Done with the last batch, so send whatever was held back for it before asking for more
+        flush();
+        rxCount = rxIndex = 0;
+        if(sockfd < 0) return 0;
+
+        for(unsigned int i = 0; i < batchSize; i++){
+            rxVecs[i].iov_base = &rxBuffers[i * MAX_SNMP_PACKET_LENGTH];
+            rxVecs[i].iov_len = MAX_SNMP_PACKET_LENGTH;
+
+            memset(&rxMessages[i].msg_hdr, 0, sizeof(rxMessages[i].msg_hdr));
+            rxMessages[i].msg_hdr.msg_iov = &rxVecs[i];
+            rxMessages[i].msg_hdr.msg_iovlen = 1;
+            rxMessages[i].msg_hdr.msg_name = &rxAddresses[i];
+            rxMessages[i].msg_hdr.msg_namelen = sizeof(rxAddresses[i]);
+        }
+
+        int received = recvmmsg(sockfd, rxMessages.data(), batchSize, MSG_DONTWAIT, nullptr);
+        if(received <= 0) return 0;
+        rxCount = received;
+    }
+
+    // Anything that didn't fit is reported as too big for the agent to take
+    if(rxMessages[rxIndex].msg_hdr.msg_flags & MSG_TRUNC){
+        return MAX_SNMP_PACKET_LENGTH + 1;
+    }
+    return rxMessages[rxIndex].msg_len;
+}
+
+int LinuxUDP::read(uint8_t* buf, int len){
+    if(rxIndex >= rxCount || len <= 0) return 0;
+
+    int length = rxMessages[rxIndex].msg_len;
+    if(length > len) length = len;
+    memcpy(buf, &rxBuffers[rxIndex * MAX_SNMP_PACKET_LENGTH], length);
+    return length;
+}
+
+IPAddress LinuxUDP::remoteIP(){
+    if(rxIndex >= rxCount) return IPAddress();
+    return IPAddress((uint32_t)((struct sockaddr_in*)&rxAddresses[rxIndex])->sin_addr.s_addr);
+}
+
+int LinuxUDP::remotePort(){
+    if(rxIndex >= rxCount) return 0;
+    return ntohs(((struct sockaddr_in*)&rxAddresses[rxIndex])->sin_port);
+}
+
+void LinuxUDP::beginPacket(IPAddress ip, uint16_t port){
+    if(txCount >= batchSize) flush();
+
+    struct sockaddr_in* address = (struct sockaddr_in*)&txAddresses[txCount];
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = (uint32_t)ip;
+    address->sin_port = htons(port);
+
+    txVecs[txCount].iov_base = &txBuffers[txCount * MAX_SNMP_PACKET_LENGTH];
+    txVecs[txCount].iov_len = 0;
+    txOpen = true;
+}
+
+void LinuxUDP::write(const uint8_t* buf, size_t len){
+    if(!txOpen) return;
+
+    size_t used = txVecs[txCount].iov_len;
+    if(used + len > MAX_SNMP_PACKET_LENGTH){
+        SNMP_LOGW("Packet too large to send, dropping it\n");
+        txOpen = false;
+        failedCount++;
+        return;
+    }
+    memcpy((uint8_t*)txVecs[txCount].iov_base + used, buf, len);
+    txVecs[txCount].iov_len = used + len;
+}
+
+int LinuxUDP::endPacket(){
+    if(!txOpen) return 0;
+    txOpen = false;
+
+    memset(&txMessages[txCount].msg_hdr, 0, sizeof(txMessages[txCount].msg_hdr));
+    txMessages[txCount].msg_hdr.msg_iov = &txVecs[txCount];
+    txMessages[txCount].msg_hdr.msg_iovlen = 1;
+    txMessages[txCount].msg_hdr.msg_name = &txAddresses[txCount];
+    txMessages[txCount].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    txCount++;
+
+    if(holding || batchPending()) return 1;
+    return flush() > 0;
+}
+
+int LinuxUDP::flush(){
+    unsigned int sent = 0;
+    while(sockfd >= 0 && sent < txCount){
+        int i = sendmmsg(sockfd, &txMessages[sent], txCount - sent, 0);
+        if(i < 0){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                // Socket buffer's full, wait for it to drain a bit rather than dropping responses
+                struct pollfd pfd = { sockfd, POLLOUT, 0 };
+                if(poll(&pfd, 1, 10) > 0) continue;
+            }
+            SNMP_LOGW("Failed to send %d packets: %d\n", txCount - sent, errno);
+            break;
+        }
+        sent += i;
+    }
+
+    sentCount += sent;
+    failedCount += txCount - sent;
+    txCount = 0;
+    return sent;
+}
+
+int LinuxUDP::localPort() const {
+    if(sockfd < 0) return 0;
+
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    if(getsockname(sockfd, (struct sockaddr*)&address, &length) < 0) return 0;
+    return ntohs(address.sin_port);
+}
+
+bool LinuxUDP::waitForPacket(int timeoutMs){
+    if(batchPending()) return true;
+    if(sockfd < 0) return false;
+
+    struct pollfd pfd = { sockfd, POLLIN, 0 };
+    return poll(&pfd, 1, timeoutMs) > 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef LinuxUDP_h
+#define LinuxUDP_h
+
+// Only for Linux host builds (say a gateway running the agent), built with SNMP_HOST_LINUX defined.
+// Arduino targets use the UDP class from their core
+#if defined(SNMP_HOST_LINUX) && defined(__linux__)
+#define SNMP_LINUX_UDP
+
+#include "tests/required/UDP.h"
+#include "include/defs.h"
+
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+// UDP over a plain non-blocking Linux socket, moving datagrams in batches with recvmmsg()/sendmmsg().
+// parsePacket() hands out the datagrams from the last recvmmsg() one at a time and only goes back to the kernel once they've all been read.
+// Responses are held back while more of the batch is still to be read, and all sent together with one sendmmsg() once it's done,
+// or when flush() is called. Anything sent outside of a batch (like traps) goes out straight away.
+class LinuxUDP: public UDP {
+  public:
+    explicit LinuxUDP(unsigned int batchSize = 32);
+    ~LinuxUDP() override;
+
+    // Has to be set before begin(), lets several sockets (say one per thread) bind the same port and have the kernel share datagrams between them
+    void setReusePort(bool reuse){ reusePort = reuse; }
+
+    void begin(int port) override;
+    void stop() override;
+
+    int parsePacket() override;
+    int read(uint8_t* buf, int len) override;
+    IPAddress remoteIP() override;
+    int remotePort() override;
+
+    void beginPacket(IPAddress ip, uint16_t port) override;
+    void write(const uint8_t* buf, size_t len) override;
+    int endPacket() override;
+
+    // Sends everything held back, returns how many datagrams went out
+    int flush();
+    // Totals since the socket was created, counted when datagrams actually leave (or fail to), not when they're queued
+    unsigned long datagramsSent() const { return sentCount; }
+    unsigned long datagramsFailed() const { return failedCount; }
+    // While held, everything sent waits to go out together (say a trap to many receivers), releasing sends it all
+    void holdSends(bool hold){
+        holding = hold;
+        if(!hold) flush();
+    }
+    // Blocks until a datagram is waiting or timeoutMs passes (-1 to wait forever), returns true if there's something to parse
+    bool waitForPacket(int timeoutMs);
+
+    int fd() const { return sockfd; }
+    // The port actually bound, which is how to find out what begin(0) picked. 0 if not bound
+    int localPort() const;
+
+  private:
+    const unsigned int batchSize;
+    int sockfd = -1;
+    bool reusePort = false;
+
+    std::vector<uint8_t> rxBuffers;
+    std::vector<struct mmsghdr> rxMessages;
+    std::vector<struct iovec> rxVecs;
+    std::vector<struct sockaddr_storage> rxAddresses;
+    unsigned int rxCount = 0;
+    unsigned int rxIndex = 0;
+
+    std::vector<uint8_t> txBuffers;
+    std::vector<struct mmsghdr> txMessages;
+    std::vector<struct iovec> txVecs;
+    std::vector<struct sockaddr_storage> txAddresses;
+    unsigned int txCount = 0;
+    bool txOpen = false;
+    bool holding = false;
+    std::atomic<unsigned long> sentCount{0};
+    std::atomic<unsigned long> failedCount{0};
+
+    bool batchPending() const { return rxIndex + 1 < rxCount; }
+};
+
+#endif
+#endif
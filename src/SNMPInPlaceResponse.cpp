@@ -0,0 +1,229 @@
+#include "include/SNMPParser.h"
+#include "include/SNMPResponseWriter.h"
+
+// A GetResponse shares its version, community, requestID and varbind OIDs with the GetRequest it answers.
+// Rather than decoding the request into objects and encoding it all again, those bytes are kept (just moved into place),
+// and only the PDU type, error fields, value TLVs and the lengths around them are written.
+
+// Reads the TLV at ptr, which has to be of the expected type and fit before end
+static bool read_tlv(const uint8_t* ptr, const uint8_t* end, ASN_TYPE expected, size_t* headerLength, size_t* length){
+    ASN_TYPE type;
+    int i = decode_ber_header(ptr, end - ptr, &type, length);
+    if(i < 0 || type != expected) return false;
+    *headerLength = i;
+    return true;
+}
+
+// Reads a whole varbind, giving back the OID TLV within it and where the next varbind starts
+static bool read_varbind(const uint8_t* ptr, const uint8_t* end, const uint8_t** oid, size_t* oidLength, size_t* oidHeaderLength, const uint8_t** next){
+    size_t headerLength, length;
+    if(!read_tlv(ptr, end, STRUCTURE, &headerLength, &length)) return false;
+    const uint8_t* varbindEnd = ptr + headerLength + length;
+    ptr += headerLength;
+
+    size_t oidValueLength;
+    if(!read_tlv(ptr, varbindEnd, OID, oidHeaderLength, &oidValueLength)) return false;
+    if(oidValueLength < 1 || ptr[*oidHeaderLength] != 0x2b) return false;
+    *oid = ptr;
+    *oidLength = *oidHeaderLength + oidValueLength;
+    ptr += *oidLength;
+
+    // Value can be anything, but it has to fill out the rest of the varbind
+    ASN_TYPE valueType;
+    size_t valueLength;
+    int valueHeaderLength = decode_ber_header(ptr, varbindEnd - ptr, &valueType, &valueLength);
+    if(valueHeaderLength < 0 || ptr + valueHeaderLength + valueLength != varbindEnd) return false;
+
+    *next = varbindEnd;
+    return true;
+}
+
+static bool community_matches(const uint8_t* community, size_t length, const std::string& expected){
+    return !expected.empty() && length == expected.length() && memcmp(community, expected.data(), length) == 0;
+}
+
+SNMP_ERROR_RESPONSE handleGetRequestInPlace(uint8_t* buffer, int packetLength, int* responseLength, int max_packet_size, const std::deque<ValueCallback*>&callbacks, const std::string& _community, const std::string& _readOnlyCommunity, SNMPAgentStats* stats){
+    if(packetLength <= 0 || packetLength > max_packet_size) return SNMP_NO_PACKET;
+
+    // Walk and check the whole request before touching anything, so we can leave it to the full path if it's not a plain GetRequest
+    const uint8_t* end = buffer + packetLength;
+    size_t headerLength, length;
+
+    if(!read_tlv(buffer, end, STRUCTURE, &headerLength, &length)) return SNMP_NO_PACKET;
+    uint8_t* versionStart = buffer + headerLength;
+    uint8_t* ptr = versionStart;
+    end = versionStart + length;
+
+    if(!read_tlv(ptr, end, INTEGER, &headerLength, &length) || length < 1 || length > 4) return SNMP_NO_PACKET;
+    for(size_t i = 0; i < length - 1; i++){
+        if(ptr[headerLength + i] != 0) return SNMP_NO_PACKET;
+    }
+    if(ptr[headerLength + length - 1] >= SNMP_VERSION_MAX) return SNMP_NO_PACKET;
+    bool isV1 = ptr[headerLength + length - 1] == SNMP_VERSION_1;
+    ptr += headerLength + length;
+
+    // Bad communities are left for the full path to reject
+    if(!read_tlv(ptr, end, STRING, &headerLength, &length)) return SNMP_NO_PACKET;
+    if(!community_matches(ptr + headerLength, length, _community) && !community_matches(ptr + headerLength, length, _readOnlyCommunity)){
+        return SNMP_NO_PACKET;
+    }
+    ptr += headerLength + length;
+    size_t versionCommunityLength = ptr - versionStart;
+
+    if(!read_tlv(ptr, end, GetRequestPDU, &headerLength, &length)) return SNMP_NO_PACKET;
+    end = ptr + headerLength + length;
+    ptr += headerLength;
+
+    uint8_t* requestIDStart = ptr;
+    if(!read_tlv(ptr, end, INTEGER, &headerLength, &length)) return SNMP_NO_PACKET;
+    ptr += headerLength + length;
+    size_t requestIDLength = ptr - requestIDStart;
+
+    // errorStatus and errorIndex mean nothing in a request, they get rewritten
+    for(int i = 0; i < 2; i++){
+        if(!read_tlv(ptr, end, INTEGER, &headerLength, &length)) return SNMP_NO_PACKET;
+        ptr += headerLength + length;
+    }
+
+    if(!read_tlv(ptr, end, STRUCTURE, &headerLength, &length)) return SNMP_NO_PACKET;
+    uint8_t* varbindsStart = ptr + headerLength;
+    size_t varbindsLength = length;
+
+    const uint8_t* oid;
+    size_t oidLength, oidHeaderLength;
+    const uint8_t* next;
+    for(const uint8_t* varbind = varbindsStart; varbind < varbindsStart + varbindsLength; varbind = next){
+        if(!read_varbind(varbind, varbindsStart + varbindsLength, &oid, &oidLength, &oidHeaderLength, &next)) return SNMP_NO_PACKET;
+    }
+
+    // Response varbinds are written after the biggest header this response could need, with the request varbinds moved
+    // out of the way to the very end of the buffer. Each one is only overwritten once its OID has been copied forward.
+    // A v1 tooBig has to echo the request's varbinds, so for v1 the request is left whole and the response is built after it instead;
+    // if it doesn't fit there the untouched request goes to the full path, which can echo them.
+    uint8_t* bufferEnd = buffer + max_packet_size;
+    size_t reserved = SNMP_MAX_CONTAINER_HEADER_LENGTH + versionCommunityLength
+                    + SNMP_MAX_CONTAINER_HEADER_LENGTH + requestIDLength + SNMP_INTEGER_TLV_LENGTH * 2
+                    + SNMP_MAX_CONTAINER_HEADER_LENGTH;
+    if(buffer + reserved < requestIDStart + requestIDLength) return SNMP_NO_PACKET;
+
+    uint8_t* source;
+    uint8_t* sourceEnd;
+    uint8_t* varbindsOut;
+    if(isV1){
+        source = varbindsStart;
+        sourceEnd = varbindsStart + varbindsLength;
+        varbindsOut = buffer + (reserved > (size_t)packetLength ? reserved : packetLength);
+        if(varbindsOut >= bufferEnd) return SNMP_NO_PACKET;
+    } else {
+        source = bufferEnd - varbindsLength;
+        sourceEnd = bufferEnd;
+        varbindsOut = buffer + reserved;
+        if(varbindsOut > source) return SNMP_NO_PACKET;
+    }
+
+    SNMP_LOGD("Answering GetRequest in place\n");
+    if(!isV1) memmove(source, varbindsStart, varbindsLength);
+
+    uint8_t* out = varbindsOut;
+    SNMP_ERROR_STATUS errorStatus = NO_ERROR;
+    int errorIndex = 0;
+    int index = 0;
+    bool tooBig = false;
+
+    while(source < sourceEnd){
+        read_varbind(source, sourceEnd, &oid, &oidLength, &oidHeaderLength, &next);
+        index++;
+
+        // Everything before the next request varbind is free to write over once this OID has been copied
+        uint8_t* limit = isV1 ? bufferEnd : (uint8_t*)next;
+        uint8_t* body = out + 2;
+        if(body + oidLength > limit){
+            tooBig = true;
+            break;
+        }
+
+        ValueCallback* callback = ValueCallback::findCallback(callbacks, oid + oidHeaderLength, oidLength - oidHeaderLength);
+        memmove(body, oid, oidLength);
+
+        uint8_t* valuePtr = body + oidLength;
+        int valueLength;
+        if(!callback){
+            SNMP_LOGD("Couldn't find callback\n");
+            valueLength = encode_ber_header(valuePtr, limit - valuePtr, NOSUCHOBJECT, 0);
+        } else {
+            valueLength = ValueCallback::serialiseValueForCallback(callback, valuePtr, limit - valuePtr);
+            if(valueLength < 0 && valueLength != SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED){
+                SNMP_LOGD("Couldn't get value for callback\n");
+                valueLength = encode_ber_header(valuePtr, limit - valuePtr, NULLTYPE, 0);
+                errorStatus = GEN_ERR;
+                errorIndex = index;
+            }
+        }
+        if(valueLength < 0){
+            tooBig = true;
+            break;
+        }
+
+        size_t bodyLength = oidLength + valueLength;
+        size_t extraLengthBytes = encode_ber_length_integer_count(bodyLength) - 1;
+        if(extraLengthBytes){
+            if(body + bodyLength + extraLengthBytes > limit){
+                tooBig = true;
+                break;
+            }
+            memmove(body + extraLengthBytes, body, bodyLength);
+        }
+        out += encode_ber_header(out, limit - out, STRUCTURE, bodyLength) + bodyLength;
+
+        source = (uint8_t*)next;
+    }
+
+    // Nothing of a v1 request has been written over, so SNMPResponseWriter can answer it with the varbinds echoed
+    if(tooBig && isV1){
+        SNMP_LOGD("Response too big after %d varbinds, leaving v1 tooBig to the full path\n", index - 1);
+        return SNMP_NO_PACKET;
+    }
+
+    // The version, community and requestID are still there ahead of what we wrote, so a v2c tooBig can still be put together
+    if(tooBig){
+        SNMP_LOGD("Response too big after %d varbinds, sending tooBig\n", index - 1);
+        out = varbindsOut;
+        errorStatus = TOO_BIG;
+        errorIndex = 0;
+    }
+
+    // Now the lengths are known, move everything into its final place and fill in the headers around it
+    size_t outLength = out - varbindsOut;
+    size_t pduLength = requestIDLength + SNMP_INTEGER_TLV_LENGTH * 2 + ber_tlv_length(outLength);
+    size_t messageLength = versionCommunityLength + ber_tlv_length(pduLength);
+    size_t totalLength = ber_tlv_length(messageLength);
+    size_t finalHeaderLength = totalLength - outLength;
+
+    uint8_t* packetEnd = buffer + totalLength;
+    uint8_t* newVersionStart = buffer + 1 + encode_ber_length_integer_count(messageLength);
+    uint8_t* newPDUStart = newVersionStart + versionCommunityLength;
+    uint8_t* newRequestIDStart = newPDUStart + 1 + encode_ber_length_integer_count(pduLength);
+
+    // Headers only ever shrink or grow by a couple of bytes, so none of these can clobber what's still to be moved
+    memmove(buffer + finalHeaderLength, varbindsOut, outLength);
+    memmove(newRequestIDStart, requestIDStart, requestIDLength);
+    memmove(newVersionStart, versionStart, versionCommunityLength);
+
+    encode_ber_header(buffer, totalLength, STRUCTURE, messageLength);
+    encode_ber_header(newPDUStart, packetEnd - newPDUStart, GetResponsePDU, pduLength);
+
+    ptr = newRequestIDStart + requestIDLength;
+    ptr += encode_ber_integer(ptr, packetEnd - ptr, INTEGER, errorStatus);
+    ptr += encode_ber_integer(ptr, packetEnd - ptr, INTEGER, errorIndex);
+    encode_ber_header(ptr, packetEnd - ptr, STRUCTURE, outLength);
+
+    if(stats){
+        stats->count(SNMP_IN_GET_REQUESTS);
+        if(errorStatus == NO_ERROR) stats->count(SNMP_IN_TOTAL_REQ_VARS, index);
+        stats->countErrorStatus(errorStatus, true);
+        stats->count(SNMP_OUT_GET_RESPONSES);
+    }
+
+    *responseLength = totalLength;
+    return tooBig ? SNMP_ERROR_PACKET_SENT : SNMP_GET_OCCURRED;
+}
@@ -1,108 +1,295 @@
 #include "include/SNMPInform.h"
 #include "SNMPTrap.h"
 
-#include <list>
-#ifdef COMPILING_TESTS
+#include <algorithm>
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
     #include <tests/required/millis.h>
 #endif
 
-inline void delete_inform(struct InformItem* inform){
-    free(inform);
+void* InformNodePool::allocate(size_t bytes){
+    if(!blockSize) blockSize = bytes;
+    if(bytes == blockSize && freeBlocks){
+        void* block = freeBlocks;
+        freeBlocks = *static_cast<void**>(block);
+        freeCount--;
+        return block;
+    }
+    return ::operator new(bytes);
+}
+
+void InformNodePool::deallocate(void* ptr, size_t bytes){
+    if(bytes != blockSize || bytes < sizeof(void*) || freeCount >= SNMP_INFORM_MAX_FREE_ITEMS){
+        ::operator delete(ptr);
+        return;
+    }
+    *static_cast<void**>(ptr) = freeBlocks;
+    freeBlocks = ptr;
+    freeCount++;
+}
+
+InformNodePool::~InformNodePool(){
+    while(freeBlocks){
+        void* next = *static_cast<void**>(freeBlocks);
+        ::operator delete(freeBlocks);
+        freeBlocks = next;
+    }
 }
 
-static void remove_inform_from_list(std::list<struct InformItem *> &list,
-                             std::function<bool(struct InformItem *)> predicate) {
-    list.remove_if([&predicate](struct InformItem* item){
-        if(predicate(item)){
-            delete_inform(item);
-            return true;
+// The indexes' buckets are sized up front, they only ever grow past that if more Informs than that are outstanding at once
+InformQueue::InformQueue():
+    requestIDNodes(new InformNodePool()),
+    trapNodes(new InformNodePool()),
+    byRequestID(SNMP_INFORM_MAX_FREE_ITEMS, std::hash<snmp_request_id_t>(), std::equal_to<snmp_request_id_t>(), InformNodeAllocator<RequestIDEntry>(requestIDNodes.get())),
+    byTrap(SNMP_INFORM_MAX_FREE_ITEMS, std::hash<SNMPTrap*>(), std::equal_to<SNMPTrap*>(), InformNodeAllocator<TrapEntry>(trapNodes.get())){
+    heap.reserve(SNMP_INFORM_MAX_FREE_ITEMS);
+    freeItems.reserve(SNMP_INFORM_MAX_FREE_ITEMS);
+}
+
+InformQueue::~InformQueue(){
+    for(auto item : heap) delete item;
+    for(auto item : freeItems) delete item;
+}
+
+static struct InformItem* new_inform(InformQueue &informQueue){
+    if(informQueue.freeItems.empty()){
+        return new InformItem();
+    }
+    // Every field is set again by queue_inform(), the encode buffer is left as it is so its capacity can be reused
+    struct InformItem* item = informQueue.freeItems.back();
+    informQueue.freeItems.pop_back();
+    return item;
+}
+
+// Only once it's out of the heap. The encoded copy keeps its capacity, the next Inform is usually the same trap and the same size
+inline void delete_inform(InformQueue &informQueue, struct InformItem* inform){
+    if(informQueue.freeItems.size() >= SNMP_INFORM_MAX_FREE_ITEMS){
+        delete inform;
+        return;
+    }
+    inform->encoded.clear();
+    informQueue.freeItems.push_back(inform);
+}
+
+static void unindex_trap(InformQueue &informQueue, struct InformItem* item){
+    auto range = informQueue.byTrap.equal_range(item->trap);
+    for(auto it = range.first; it != range.second; ++it){
+        if(it->second == item){
+            informQueue.byTrap.erase(it);
+            return;
         }
-        return false;
-    });
+    }
 }
 
-snmp_request_id_t
-queue_and_send_trap(std::list<struct InformItem *> &informList, SNMPTrap *trap, const IPAddress& ip, bool replaceQueuedRequests,
-                    int retries, int delay_ms) {
-    bool buildStatus = trap->buildForSending();
-    if(!buildStatus) {
+// Stops indexing it, the heap lets go of it once it reaches the top
+static void finish_inform(InformQueue &informQueue, struct InformItem* item){
+    informQueue.byRequestID.erase(item->requestID);
+    unindex_trap(informQueue, item);
+}
+
+// Heap order for the queue, earliest dueAt on top. Compared by difference so it still works across millis() wrapping
+static bool due_after(const struct InformItem* a, const struct InformItem* b){
+    return (long)(a->dueAt - b->dueAt) > 0;
+}
+
+static void push_inform(InformQueue &informQueue, struct InformItem* item){
+    item->dueAt = item->lastSent + item->delay_ms + 1;
+    informQueue.heap.push_back(item);
+    std::push_heap(informQueue.heap.begin(), informQueue.heap.end(), due_after);
+}
+
+static struct InformItem* pop_inform(InformQueue &informQueue){
+    std::pop_heap(informQueue.heap.begin(), informQueue.heap.end(), due_after);
+    struct InformItem* item = informQueue.heap.back();
+    informQueue.heap.pop_back();
+    return item;
+}
+
+static inline bool is_finished(const struct InformItem* item){
+    return item->received || item->cancelled;
+}
+
+// Frees anything finished that's made it to the top, so the top is always something still waiting on a response
+static void prune_finished(InformQueue &informQueue){
+    while(!informQueue.heap.empty() && is_finished(informQueue.heap.front())){
+        delete_inform(informQueue, pop_inform(informQueue));
+    }
+}
+
+static void cancel_informs_for_trap(InformQueue &informQueue, SNMPTrap* trap){
+    auto range = informQueue.byTrap.equal_range(trap);
+    for(auto it = range.first; it != range.second; ++it){
+        it->second->cancelled = true;
+        informQueue.byRequestID.erase(it->second->requestID);
+    }
+    informQueue.byTrap.erase(range.first, range.second);
+    prune_finished(informQueue);
+}
+
+// Queues an Inform that was encoded as `encoded`, keeping its own copy to resend, and sends it
+static bool queue_inform(InformQueue &informQueue, SNMPTrap *trap, const IPAddress& ip, snmp_request_id_t requestID,
+                         const uint8_t* encoded, size_t length, int retries, int delay_ms) {
+    struct InformItem* item = new_inform(informQueue);
+
+    // Each Inform keeps its own copy of what was sent, so later sends from the same trap can't change what gets retried.
+    // A reused item only allocates here if this one's bigger than anything it's held before
+    item->encoded.assign(encoded, encoded + length);
+
+    item->delay_ms = delay_ms;
+    item->received = false;
+    item->requestID = requestID;
+    item->retries = retries;
+    item->ip = ip;
+    item->lastSent = millis();
+    item->trap = trap;
+    item->missed = false;
+    item->cancelled = false;
+
+    SNMP_LOGD("Adding Inform request to queue: %lu\n", item->requestID);
+
+    // A repeated requestID would otherwise leave the older one unacknowledgeable
+    auto existing = informQueue.byRequestID.find(item->requestID);
+    if(existing != informQueue.byRequestID.end()){
+        existing->second->cancelled = true;
+        finish_inform(informQueue, existing->second);
+    }
+
+    push_inform(informQueue, item);
+    informQueue.byRequestID[item->requestID] = item;
+    informQueue.byTrap.insert(std::make_pair(trap, item));
+
+    return trap->sendPacket(item->encoded.data(), item->encoded.size(), ip);
+}
+
+// Encodes a fresh send of the trap into buffer, and cancels its outstanding informs if asked to
+static int prepare_trap(InformQueue &informQueue, SNMPTrap *trap, bool replaceQueuedRequests, uint8_t* buffer) {
+    int length = trap->encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+    if(length <= 0) {
         SNMP_LOGW("Couldn't build trap\n");
-        return INVALID_SNMP_REQUEST_ID;
+        return length;
     };
-    SNMP_LOGD("%lu informs in informList", informList.size());
-    //TODO: could be race condition here, buildStatus to return packet?
+    SNMP_LOGD("%lu informs in informQueue", informQueue.size());
     if(replaceQueuedRequests){
         SNMP_LOGD("Removing any outstanding informs for this trap\n");
-        remove_inform_from_list(informList, [trap](struct InformItem* informItem) -> bool {
-            return informItem->trap == trap;
-        });
+        cancel_informs_for_trap(informQueue, trap);
     }
+    return length;
+}
 
-    if(trap->inform){
-        struct InformItem* item = (struct InformItem*)calloc(1, sizeof(struct InformItem));
-        item->delay_ms = delay_ms;
-        item->received = false;
-        item->requestID = trap->requestID;
-        item->retries = retries;
-        item->ip = ip;
-        item->lastSent = millis();
-        item->trap = trap;
-        item->missed = false;
-
-        SNMP_LOGD("Adding Inform request to queue: %lu\n", item->requestID);
-
-        informList.push_back(item);
+snmp_request_id_t
+queue_and_send_trap(InformQueue &informQueue, SNMPTrap *trap, const IPAddress& ip, bool replaceQueuedRequests,
+                    int retries, int delay_ms) {
+    uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+    int length = prepare_trap(informQueue, trap, replaceQueuedRequests, buffer);
+    if(length <= 0){
+        return INVALID_SNMP_REQUEST_ID;
+    }
 
-        trap->sendTo(ip, true);
+    if(trap->inform){
+        queue_inform(informQueue, trap, ip, trap->requestID, buffer, length, retries, delay_ms);
     } else {
         // normal send
         SNMP_LOGD("Sending normal trap\n");
-        trap->sendTo(ip);
+        trap->sendPacket(buffer, length, ip);
     }
 
     return trap->requestID;
 }
 
-void inform_callback(std::list<struct InformItem *> &informList, snmp_request_id_t requestID, bool responseReceiveSuccess) {
+int queue_and_send_trap_to_all(InformQueue &informQueue, SNMPTrap *trap, const std::vector<IPAddress>& ips, bool replaceQueuedRequests,
+                               int retries, int delay_ms) {
+    if(ips.empty()) return 0;
+
+    uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+    int length = prepare_trap(informQueue, trap, replaceQueuedRequests, buffer);
+    if(length <= 0){
+        return 0;
+    }
+
+    int sent = 0;
+    if(!trap->inform){
+        // Every receiver gets exactly the same trap
+        for(const auto& ip : ips){
+            sent += trap->sendPacket(buffer, length, ip);
+        }
+        return sent;
+    }
+
+    int requestIDOffset = trap->encodedRequestIDOffset();
+    if(requestIDOffset < 0){
+        SNMP_LOGW("Couldn't find requestID in encoded inform\n");
+        return 0;
+    }
+
+    // Each receiver acknowledges its own Inform, so each needs its own requestID, the rest of the packet is shared
+    snmp_request_id_t requestID = trap->requestID;
+    for(size_t i = 0; i < ips.size(); i++){
+        if(i > 0){
+            requestID = SNMPPacket::generate_request_id();
+            buffer[requestIDOffset] = requestID >> 24;
+            buffer[requestIDOffset + 1] = requestID >> 16;
+            buffer[requestIDOffset + 2] = requestID >> 8;
+            buffer[requestIDOffset + 3] = requestID;
+        }
+        sent += queue_inform(informQueue, trap, ips[i], requestID, buffer, length, retries, delay_ms);
+    }
+    return sent;
+}
+
+void inform_callback(InformQueue &informQueue, snmp_request_id_t requestID, bool responseReceiveSuccess) {
     (void)responseReceiveSuccess;
     SNMP_LOGD("Receiving InformCallback for requestID: %lu, success: %d\n", requestID, responseReceiveSuccess);
     //TODO: if we ever want to keep received informs, change this logic
 
-    remove_inform_from_list(informList, [requestID](struct InformItem* informItem) -> bool {
-        return informItem->requestID == requestID;
-    });
+    auto found = informQueue.byRequestID.find(requestID);
+    if(found != informQueue.byRequestID.end()){
+        struct InformItem* item = found->second;
+        item->received = true;
+        finish_inform(informQueue, item);
+        prune_finished(informQueue);
+    }
 
-    SNMP_LOGD("Informs waiting for responses: %lu\n", informList.size());
+    SNMP_LOGD("Informs waiting for responses: %lu\n", informQueue.size());
 }
 
-void handle_inform_queue(std::list<struct InformItem *> &informList) {
+void handle_inform_queue(InformQueue &informQueue) {
     auto thisLoop = millis();
-    for(auto informItem : informList){
-        if(!informItem->received && thisLoop - informItem->lastSent > informItem->delay_ms){
-            SNMP_LOGD("Missed Inform receive\n");
-            // check if sending again
-            informItem->missed = true;
-            if(!informItem->retries){
-                SNMP_LOGD("No more retries for inform: %lu, removing\n", informItem->requestID);
-                continue;
-            }
-            if(informItem->trap){
-                SNMP_LOGD("No response received in %lums, Resending Inform: %lu\n", thisLoop - informItem->lastSent, informItem->requestID);
-                informItem->trap->sendTo(informItem->ip, true);
-                informItem->lastSent = thisLoop;
-                informItem->missed = false;
-                informItem->retries--;
-            }
+
+    // Only what's due gets looked at, everything else is further down the heap
+    while(!informQueue.heap.empty() && (long)(thisLoop - informQueue.heap.front()->dueAt) >= 0){
+        struct InformItem* informItem = pop_inform(informQueue);
+        if(is_finished(informItem)){
+            delete_inform(informQueue, informItem);
+            continue;
         }
+
+        SNMP_LOGD("Missed Inform receive\n");
+        informItem->missed = true;
+        if(!informItem->retries || !informItem->trap){
+            SNMP_LOGD("No more retries for inform: %lu, removing\n", informItem->requestID);
+            finish_inform(informQueue, informItem);
+            delete_inform(informQueue, informItem);
+            continue;
+        }
+
+        SNMP_LOGD("No response received in %lums, Resending Inform: %lu\n", thisLoop - informItem->lastSent, informItem->requestID);
+        informItem->trap->sendPacket(informItem->encoded.data(), informItem->encoded.size(), informItem->ip);
+        informItem->lastSent = thisLoop;
+        informItem->missed = false;
+        informItem->retries--;
+        push_inform(informQueue, informItem);
     }
-    remove_inform_from_list(informList, [](struct InformItem* informItem) -> bool {
-        return informItem->received || (informItem->retries == 0 && informItem->missed);
-    });
+
+    prune_finished(informQueue);
 }
 
-void mark_trap_deleted(std::list<struct InformItem *> &informList, SNMPTrap *trap) {
+void mark_trap_deleted(InformQueue &informQueue, SNMPTrap *trap) {
     SNMP_LOGD("Removing waiting Informs tied to Trap.\n");
-    remove_inform_from_list(informList, [trap](struct InformItem* informItem) -> bool {
-        return informItem->trap == trap;
-    });
+    cancel_informs_for_trap(informQueue, trap);
+}
+
+long next_inform_timeout(const InformQueue &informQueue) {
+    if(informQueue.heap.empty()) return -1;
+
+    long timeout = (long)(informQueue.heap.front()->dueAt - millis());
+    return timeout > 0 ? timeout : 0;
 }
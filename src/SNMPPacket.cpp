@@ -1,7 +1,5 @@
 #include "include/SNMPPacket.h"
 
-#define SNMP_PARSE_ERROR_AT_STATE(STATE) ((int)STATE * -1) - 10 + SNMP_PACKET_PARSE_ERROR_OFFSET
-
 #define ASN_TYPE_FOR_STATE_SNMPVERSION  INTEGER
 #define ASN_TYPE_FOR_STATE_COMMUNITY    STRING
 #define ASN_TYPE_FOR_STATE_REQUESTID    INTEGER
@@ -36,7 +34,10 @@ SNMPPacket::~SNMPPacket(){
 }
 
 SNMP_PACKET_PARSE_ERROR SNMPPacket::parsePacket(ComplexType *structure, enum SNMPParsingState state) {
-    for(const auto& value : structure->values){
+    // PDU and VARBINDS step down into their value instead of recursing, we never need to come back up
+    size_t index = 0;
+    while(index < structure->values.size()){
+        const auto& value = structure->values[index++];
         if(state == DONE) break;
 
         switch(state) {
@@ -44,11 +45,12 @@ SNMP_PACKET_PARSE_ERROR SNMPPacket::parsePacket(ComplexType *structure, enum SNM
             case SNMPVERSION:
                 ASSERT_ASN_STATE_TYPE(value, SNMPVERSION);
                 this->snmpVersionPtr = std::static_pointer_cast<IntegerType>(value);
-                this->snmpVersion = (SNMP_VERSION) this->snmpVersionPtr.get()->_value;
-                if (this->snmpVersion >= SNMP_VERSION_MAX) {
-                    SNMP_LOGW("Invalid SNMP Version: %d\n", this->snmpVersion);
+                // Checked before it's an enum, anything outside of it isn't a valid SNMP_VERSION
+                if (this->snmpVersionPtr.get()->_value < 0 || this->snmpVersionPtr.get()->_value >= SNMP_VERSION_MAX) {
+                    SNMP_LOGW("Invalid SNMP Version: %d\n", this->snmpVersionPtr.get()->_value);
                     return SNMP_PARSE_ERROR_AT_STATE(SNMPVERSION);
                 };
+                this->snmpVersion = (SNMP_VERSION) this->snmpVersionPtr.get()->_value;
                 state = COMMUNITY;
             break;
 
@@ -62,7 +64,10 @@ SNMP_PACKET_PARSE_ERROR SNMPPacket::parsePacket(ComplexType *structure, enum SNM
             case PDU:
                 ASSERT_ASN_PARSING_TYPE_RANGE(value, ASN_PDU_TYPE_MIN_VALUE, ASN_PDU_TYPE_MAX_VALUE)
                 this->packetPDUType = value->_type;
-                return this->parsePacket(static_cast<ComplexType*>(value.get()), REQUESTID);
+                structure = static_cast<ComplexType*>(value.get());
+                index = 0;
+                state = REQUESTID;
+            break;
 
             case REQUESTID:
                 ASSERT_ASN_STATE_TYPE(value, REQUESTID);
@@ -73,7 +78,8 @@ SNMP_PACKET_PARSE_ERROR SNMPPacket::parsePacket(ComplexType *structure, enum SNM
 
             case ERRORSTATUS:
                 ASSERT_ASN_STATE_TYPE(value, ERRORSTATUS);
-                this->errorStatus.errorStatus = (SNMP_ERROR_STATUS) static_cast<IntegerType *>(value.get())->_value;
+                // Kept as an int, it's anything the sender put there (or nonRepeaters for a GetBulk)
+                this->errorStatus.nonRepeaters = static_cast<IntegerType *>(value.get())->_value;
                 state = ERRORID;
             break;
 
@@ -86,7 +92,10 @@ SNMP_PACKET_PARSE_ERROR SNMPPacket::parsePacket(ComplexType *structure, enum SNM
             case VARBINDS:
                 ASSERT_ASN_STATE_TYPE(value, VARBINDS);
                 // we have a varbind structure, lets dive into it.
-                return this->parsePacket(static_cast<ComplexType*>(value.get()), VARBIND);
+                structure = static_cast<ComplexType*>(value.get());
+                index = 0;
+                state = VARBIND;
+            break;
 
             case VARBIND:
             {
@@ -116,12 +125,17 @@ SNMP_PACKET_PARSE_ERROR SNMPPacket::parsePacket(ComplexType *structure, enum SNM
                 return true;
         }
     }
+    // Only the varbind list can end whenever it likes, anything else stopping short is missing part of the packet
+    if(state != VARBIND && state != DONE){
+        SNMP_LOGW("Packet ended before %d\n", state);
+        return SNMP_PARSE_ERROR_AT_STATE(state);
+    }
     return SNMP_ERROR_OK;
 }
 
 SNMP_PACKET_PARSE_ERROR SNMPPacket::parseFrom(unsigned char* buf, size_t max_len){
     SNMP_LOGD("Parsing %ld bytes\n", max_len);
-    if(buf[0] != 0x30) {
+    if(max_len < 2 || buf[0] != 0x30) {
         SNMP_LOGD("First byte error\n");
         return SNMP_PARSE_ERROR_MAGIC_BYTE;
     }
@@ -232,6 +246,8 @@ snmp_request_id_t SNMPPacket::generate_request_id(){
         request_id |= rand();
         request_id <<= 8;
         request_id |= rand();
+        // It goes on the wire as an Integer32, so keep it to what'll come back the same in a response on any platform
+        request_id &= 0x7fffffff;
     }
     return request_id;
 }
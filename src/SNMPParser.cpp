@@ -1,4 +1,5 @@
 #include "include/SNMPParser.h"
+#include "include/AllocStats.h"
 #include <string>
 
 static SNMP_PERMISSION getPermissionOfRequest(const SNMPPacket& request, const std::string& _community, const std::string& _readOnlyCommunity){
@@ -15,21 +16,48 @@ static SNMP_PERMISSION getPermissionOfRequest(const SNMPPacket& request, const s
     return requestPermission;
 }
 
-SNMP_ERROR_RESPONSE handlePacket(uint8_t* buffer, int packetLength, int* responseLength, int max_packet_size, std::deque<ValueCallback*> &callbacks, const std::string& _community, const std::string& _readOnlyCommunity, informCB informCallback, void* ctx){
+static inline void lap(SNMPAgentStats* stats, SNMP_LATENCY_PHASE phase, unsigned long& phaseStart){
+    if(stats) stats->lap(phase, phaseStart);
+}
+
+static inline void count(SNMPAgentStats* stats, SNMP_MIB_COUNTER counter, uint32_t amount = 1){
+    if(stats) stats->count(counter, amount);
+}
+
+SNMP_ERROR_RESPONSE handlePacket(uint8_t* buffer, int packetLength, int* responseLength, int max_packet_size, const std::deque<ValueCallback*>&callbacks, const std::string& _community, const std::string& _readOnlyCommunity, informCB informCallback, void* ctx, SNMPAgentStats* stats){
+    SNMP_ALLOC_REQUEST_SCOPE(allocRequest);
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_DECODE);
+
+    unsigned long phaseStart = stats && stats->timeLatency ? micros() : 0;
+    count(stats, SNMP_IN_PKTS);
+
+    // Most traffic is plain GETs, which can be answered without decoding the request into objects at all
+    SNMP_ERROR_RESPONSE inPlaceStatus = handleGetRequestInPlace(buffer, packetLength, responseLength, max_packet_size, callbacks, _community, _readOnlyCommunity, stats);
+    if(inPlaceStatus != SNMP_NO_PACKET){
+        SNMP_ALLOC_REQUEST_TYPE(allocRequest, GetRequestPDU);
+        lap(stats, SNMP_LATENCY_DISPATCH, phaseStart);
+        return inPlaceStatus;
+    }
+
     SNMPPacket request;
 
     SNMP_PACKET_PARSE_ERROR parseResult = request.parseFrom(buffer, packetLength);
     if(parseResult <= 0){
         SNMP_LOGW("Received Error code: %d when attempting to parse\n", parseResult);
+        count(stats, parseResult == SNMP_PARSE_ERROR_AT_STATE(SNMPVERSION) ? SNMP_IN_BAD_VERSIONS : SNMP_IN_ASN_PARSE_ERRS);
         return SNMP_REQUEST_INVALID;
     }
+    SNMP_ALLOC_REQUEST_TYPE(allocRequest, request.packetPDUType);
+    lap(stats, SNMP_LATENCY_DECODE, phaseStart);
 
     SNMP_LOGD("Valid SNMP Packet!");
 
     if(request.packetPDUType == GetResponsePDU){
+        count(stats, SNMP_IN_GET_RESPONSES);
+        if(stats) stats->countErrorStatus(request.errorStatus.nonRepeaters, false);
         SNMP_LOGD("Received GetResponse! probably as a result of a recent InformTrap: %lu", request.requestID);
         if(informCallback){
-            informCallback(ctx, request.requestID, !request.errorStatus.errorStatus);
+            informCallback(ctx, request.requestID, !request.errorStatus.nonRepeaters);
         } else {
             SNMP_LOGW("Not sure what to do with Inform\n");
         }
@@ -39,22 +67,31 @@ SNMP_ERROR_RESPONSE handlePacket(uint8_t* buffer, int packetLength, int* respons
     SNMP_PERMISSION requestPermission = getPermissionOfRequest(request, _community, _readOnlyCommunity);
     if(requestPermission == SNMP_PERM_NONE){
         SNMP_LOGW("Invalid communitystring provided: %s, no response to give\n", request.communityString.c_str());
+        count(stats, SNMP_IN_BAD_COMMUNITY_NAMES);
         return SNMP_REQUEST_INVALID_COMMUNITY;
     }
+    lap(stats, SNMP_LATENCY_PERMISSION, phaseStart);
     
-    // this will take the required stuff from request - like requestID and community string etc
-    SNMPResponse response = SNMPResponse(request);
-
-    std::deque<VarBind> outResponseList;
+    // Responses are written straight back into the buffer the request came in on, we're done with it now it's been parsed.
+    // The writer tracks exactly how much it's used, so whatever was left in the buffer doesn't need clearing
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_ENCODE);
+    SNMPResponseWriter response(buffer, max_packet_size);
+    if(!response.begin(request)){
+        SNMP_LOGD("Failed to build response packet");
+        count(stats, SNMP_SILENT_DROPS);
+        return SNMP_FAILED_SERIALISATION;
+    }
 
     bool pass = false;
     SNMP_ERROR_RESPONSE handleStatus = SNMP_NO_ERROR;
     SNMP_ERROR_STATUS globalError = GEN_ERR;
 
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_BUILD);
     switch(request.packetPDUType){
         case GetRequestPDU:
         case GetNextRequestPDU:
-            pass = handleGetRequestPDU(callbacks, request.varbindList, outResponseList, request.snmpVersion, request.packetPDUType == GetNextRequestPDU);
+            count(stats, request.packetPDUType == GetRequestPDU ? SNMP_IN_GET_REQUESTS : SNMP_IN_GET_NEXTS);
+            pass = handleGetRequestPDU(callbacks, request.varbindList, response, request.snmpVersion, request.packetPDUType == GetNextRequestPDU);
             handleStatus = request.packetPDUType == GetRequestPDU ? SNMP_GET_OCCURRED : SNMP_GETNEXT_OCCURRED;
         break;
         case GetBulkRequestPDU:
@@ -63,49 +100,64 @@ SNMP_ERROR_RESPONSE handlePacket(uint8_t* buffer, int packetLength, int* respons
                 pass = false;
                 globalError = GEN_ERR;
             } else {
-                pass = handleGetBulkRequestPDU(callbacks, request.varbindList, outResponseList, request.errorStatus.nonRepeaters, request.errorIndex.maxRepititions);
+                pass = handleGetBulkRequestPDU(callbacks, request.varbindList, response, request.errorStatus.nonRepeaters, request.errorIndex.maxRepititions);
                 handleStatus = SNMP_GETBULK_OCCURRED;
             }
         break;
         case SetRequestPDU:
+            count(stats, SNMP_IN_SET_REQUESTS);
             if(requestPermission != SNMP_PERM_READ_WRITE){
                 SNMP_LOGD("Attempting to perform a SET without required permissions");
+                count(stats, SNMP_IN_BAD_COMMUNITY_USES);
                 pass = false;
                 globalError = NO_ACCESS;
             } else {
-                pass = handleSetRequestPDU(callbacks, request.varbindList, outResponseList, request.snmpVersion);
+                pass = handleSetRequestPDU(callbacks, request.varbindList, response, request.snmpVersion);
                 handleStatus = SNMP_SET_OCCURRED;
             }
         break;
         default:
+            if(request.packetPDUType == TrapPDU || request.packetPDUType == Trapv2PDU) count(stats, SNMP_IN_TRAPS);
             SNMP_LOGD("Not sure what to do with SNMP PDU of type: %d\n", request.packetPDUType);
             handleStatus = SNMP_UNKNOWN_PDU_OCCURRED;
             pass = false;
         break;
     }
 
-    if(pass){
-        for(const auto& item : outResponseList){
-            if(item.errorStatus != NO_ERROR){
-                response.addErrorResponse(item);
-            } else {
-                response.addResponse(item);
-            }
-        }
-    } else {
+    if(!pass){
         // Something went wrong, generic error response
         SNMP_LOGD("Handled error when building request, error: %d, sending error PDU", globalError);
         response.setGlobalError(globalError, 0, true);
         handleStatus = SNMP_ERROR_PACKET_SENT;
     }
 
-    memset(buffer, 0, max_packet_size);
+    lap(stats, SNMP_LATENCY_DISPATCH, phaseStart);
 
-    *responseLength = response.serialiseInto(buffer, max_packet_size);
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_ENCODE);
+    *responseLength = response.finish();
+    if(response.errorStatus == TOO_BIG && handleStatus != SNMP_SET_OCCURRED){
+        // Anything set has still been set, so that's left for the agent to hear about
+        handleStatus = SNMP_ERROR_PACKET_SENT;
+    }
+    lap(stats, SNMP_LATENCY_ENCODE, phaseStart);
     if(*responseLength <= 0){
         SNMP_LOGD("Failed to build response packet");
+        count(stats, SNMP_SILENT_DROPS);
         return SNMP_FAILED_SERIALISATION;
     }
 
+    if(stats){
+        // Counted as the number of varbinds answered, so a GETBULK counts everything it walked
+        if(response.errorStatus == NO_ERROR){
+            if(handleStatus == SNMP_SET_OCCURRED){
+                stats->count(SNMP_IN_TOTAL_SET_VARS, response.varbindCount);
+            } else {
+                stats->count(SNMP_IN_TOTAL_REQ_VARS, response.varbindCount);
+            }
+        }
+        stats->countErrorStatus(response.errorStatus, true);
+        stats->count(SNMP_OUT_GET_RESPONSES);
+    }
+
     return handleStatus;
 }
\ No newline at end of file
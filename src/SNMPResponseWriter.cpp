@@ -0,0 +1,183 @@
+#include "include/SNMPResponseWriter.h"
+
+bool SNMPResponseWriter::begin(const SNMPPacket& request){
+    this->snmpVersion = request.snmpVersion;
+    this->communityString = &request.communityString;
+    this->requestID = request.requestID;
+    this->requestVarBinds = &request.varbindList;
+
+    this->varbindCount = 0;
+    this->overflowed = false;
+    this->truncate = false;
+    this->errorStatus = NO_ERROR;
+    this->errorIndex = 0;
+
+    // message, version, community, PDU, requestID, errorStatus, errorIndex and varbind list headers
+    size_t reserved = SNMP_MAX_CONTAINER_HEADER_LENGTH + SNMP_INTEGER_TLV_LENGTH
+                    + SNMP_MAX_CONTAINER_HEADER_LENGTH + this->communityString->length()
+                    + SNMP_MAX_CONTAINER_HEADER_LENGTH + SNMP_INTEGER_TLV_LENGTH * 3
+                    + SNMP_MAX_CONTAINER_HEADER_LENGTH;
+
+    if(reserved > this->max_len){
+        this->overflowed = true;
+        return false;
+    }
+
+    this->varbindStart = this->buf + reserved;
+    this->ptr = this->varbindStart;
+    return true;
+}
+
+int SNMPResponseWriter::writeOID(OIDType* oid, uint8_t* dest){
+    int length = static_cast<BER_CONTAINER*>(oid)->serialise(dest, this->buf + this->max_len - dest);
+    if(length == SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED){
+        this->overflowed = true;
+    }
+    return length;
+}
+
+int SNMPResponseWriter::commitVarBind(size_t bodyLength){
+    // The body was written assuming a short-form length, move it along if it needs more
+    uint8_t* body = this->ptr + 2;
+    size_t extraLengthBytes = encode_ber_length_integer_count(bodyLength) - 1;
+    if(extraLengthBytes){
+        if(body + bodyLength + extraLengthBytes > this->buf + this->max_len){
+            this->overflowed = true;
+            return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+        }
+        memmove(body + extraLengthBytes, body, bodyLength);
+    }
+
+    int i = encode_ber_header(this->ptr, this->buf + this->max_len - this->ptr, STRUCTURE, bodyLength);
+    CHECK_ENCODE_ERR(i);
+
+    this->ptr += i + bodyLength;
+    this->varbindCount++;
+    return SNMP_ERROR_OK;
+}
+
+int SNMPResponseWriter::addVarBind(OIDType* oid, ValueCallback* callback){
+    if(this->overflowed || this->ptr + 2 > this->buf + this->max_len){
+        this->overflowed = true;
+        return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+    }
+
+    uint8_t* body = this->ptr + 2;
+    int oidLength = writeOID(oid, body);
+    CHECK_ENCODE_ERR(oidLength);
+
+    uint8_t* valuePtr = body + oidLength;
+    int valueLength = ValueCallback::serialiseValueForCallback(callback, valuePtr, this->buf + this->max_len - valuePtr);
+    if(valueLength == SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED){
+        this->overflowed = true;
+        return valueLength;
+    }
+    if(valueLength < 0){
+        return SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM;
+    }
+
+    return commitVarBind(oidLength + valueLength);
+}
+
+int SNMPResponseWriter::addNullVarBind(OIDType* oid, ASN_TYPE nullType){
+    if(this->overflowed || this->ptr + 2 > this->buf + this->max_len){
+        this->overflowed = true;
+        return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+    }
+
+    uint8_t* body = this->ptr + 2;
+    int oidLength = writeOID(oid, body);
+    CHECK_ENCODE_ERR(oidLength);
+
+    uint8_t* valuePtr = body + oidLength;
+    int valueLength = encode_ber_header(valuePtr, this->buf + this->max_len - valuePtr, nullType, 0);
+    if(valueLength < 0){
+        this->overflowed = true;
+        return valueLength;
+    }
+
+    return commitVarBind(oidLength + valueLength);
+}
+
+int SNMPResponseWriter::addRequestVarBind(const VarBind& varbind){
+    if(this->overflowed || this->ptr + 2 > this->buf + this->max_len){
+        this->overflowed = true;
+        return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+    }
+
+    uint8_t* body = this->ptr + 2;
+    int oidLength = writeOID(varbind.oid.get(), body);
+    CHECK_ENCODE_ERR(oidLength);
+
+    uint8_t* valuePtr = body + oidLength;
+    int valueLength = varbind.value->serialise(valuePtr, this->buf + this->max_len - valuePtr);
+    if(valueLength < 0){
+        this->overflowed = true;
+        return valueLength;
+    }
+
+    return commitVarBind(oidLength + valueLength);
+}
+
+int SNMPResponseWriter::addErrorVarBind(OIDType* oid, SNMP_ERROR_STATUS error){
+    int status = addNullVarBind(oid, NULLTYPE);
+    if(status == SNMP_ERROR_OK && error != NO_ERROR){
+        this->errorStatus = error;
+        this->errorIndex = this->varbindCount;
+    }
+    return status;
+}
+
+void SNMPResponseWriter::setGlobalError(SNMP_ERROR_STATUS error, int index, bool overwrite){
+    if(this->errorStatus == NO_ERROR || overwrite){
+        this->errorStatus = error;
+        this->errorIndex = index;
+    }
+}
+
+int SNMPResponseWriter::finish(){
+    if(!this->varbindStart) return SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM;
+    if(this->overflowed && !this->truncate){
+        // Better the manager hears it asked for too much and asks for less than it times out and asks again.
+        // v2c sends no varbinds with it (RFC 3416 4.2.1), v1 sends back the request's (RFC 1157 4.1.2), unless even they don't fit
+        SNMP_LOGD("Response too big after %lu varbinds, sending tooBig\n", this->varbindCount);
+        this->ptr = this->varbindStart;
+        this->varbindCount = 0;
+        this->overflowed = false;
+        if(this->snmpVersion == SNMP_VERSION_1 && this->requestVarBinds){
+            for(const VarBind& varbind : *this->requestVarBinds){
+                if(addRequestVarBind(varbind) != SNMP_ERROR_OK){
+                    this->ptr = this->varbindStart;
+                    this->varbindCount = 0;
+                    break;
+                }
+            }
+        }
+        this->overflowed = true;
+        this->errorStatus = TOO_BIG;
+        this->errorIndex = 0;
+    }
+
+    size_t varbindsLength = this->ptr - this->varbindStart;
+    size_t pduLength = SNMP_INTEGER_TLV_LENGTH * 3 + ber_tlv_length(varbindsLength);
+    size_t messageLength = SNMP_INTEGER_TLV_LENGTH + ber_tlv_length(this->communityString->length()) + ber_tlv_length(pduLength);
+    size_t totalLength = ber_tlv_length(messageLength);
+    size_t headerLength = totalLength - varbindsLength;
+
+    // Move the varbinds back in behind where the header will actually end
+    memmove(this->buf + headerLength, this->varbindStart, varbindsLength);
+
+    uint8_t* out = this->buf;
+    uint8_t* headerEnd = this->buf + headerLength;
+
+    out += encode_ber_header(out, headerEnd - out + varbindsLength, STRUCTURE, messageLength);
+    out += encode_ber_integer(out, headerEnd - out, INTEGER, this->snmpVersion);
+    out += encode_ber_octets(out, headerEnd - out, STRING, (const uint8_t*)this->communityString->data(), this->communityString->length());
+    out += encode_ber_header(out, headerEnd - out + varbindsLength, GetResponsePDU, pduLength);
+    out += encode_ber_integer(out, headerEnd - out, INTEGER, this->requestID);
+    out += encode_ber_integer(out, headerEnd - out, INTEGER, this->errorStatus);
+    out += encode_ber_integer(out, headerEnd - out, INTEGER, this->errorIndex);
+    out += encode_ber_header(out, headerEnd - out + varbindsLength, STRUCTURE, varbindsLength);
+
+    return totalLength;
+}
@@ -4,7 +4,7 @@
 SNMPTrap::~SNMPTrap(){
     delete timestampOID;
     delete snmpTrapOID;
-    delete packet;
+    // packet is deleted by ~SNMPPacket
 }
 
 bool SNMPTrap::build(){
@@ -80,3 +80,162 @@ std::shared_ptr<ComplexType> SNMPTrap::generateVarBindList(){
 void SNMPTrap::addOIDPointer(ValueCallback* callback){
     this->callbacks.push_back(callback);
 }
+
+int SNMPTrap::encodeForSending(uint8_t* buf, size_t max_len){
+    if(templateMatches()){
+        int length = patchTemplate(buf, max_len);
+        if(length > 0) return length;
+        SNMP_LOGD("Trap template no longer fits, rebuilding\n");
+    }
+
+    encodedTemplate.encoded.clear();
+    if(!this->buildForSending()) return SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM;
+
+    int length = serialiseBuilt(buf, max_len);
+    if(length > 0) recordTemplate(buf, length);
+    return length;
+}
+
+bool SNMPTrap::templateMatches() const {
+    const TrapTemplate& t = encodedTemplate;
+    return !t.encoded.empty()
+        && t.version == this->snmpVersion
+        && t.pduType == this->packetPDUType
+        && t.community == this->communityString
+        && (t.trapOID ? this->trapOID && t.trapOID->equals(this->trapOID) : !this->trapOID)
+        && t.agentIP == this->agentIP
+        && t.genericTrap == this->genericTrap
+        && t.specificTrap == this->specificTrap
+        && t.uptimeCallback == this->uptimeCallback
+        && t.callbacks == this->callbacks;
+}
+
+int SNMPTrap::serialiseLastEncoded(uint8_t* buf, size_t max_len){
+    const TrapTemplate& t = encodedTemplate;
+    if(t.encoded.empty() || t.requestID != this->requestID){
+        return serialiseBuilt(buf, max_len);
+    }
+    if(t.encoded.size() > max_len) return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+    memcpy(buf, t.encoded.data(), t.encoded.size());
+    return t.encoded.size();
+}
+
+int SNMPTrap::patchTemplate(uint8_t* buf, size_t max_len){
+    TrapTemplate& t = encodedTemplate;
+    if(t.encoded.size() > max_len) return SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED;
+
+    // If this fails part way the template's thrown away and rebuilt, so it's fine to patch it in place
+    this->setRequestID(SNMPPacket::generate_request_id());
+    uint8_t* image = t.encoded.data();
+
+    if(t.requestIDOffset >= 0){
+        uint8_t* ptr = image + t.requestIDOffset;
+        *ptr++ = this->requestID >> 24;
+        *ptr++ = this->requestID >> 16;
+        *ptr++ = this->requestID >> 8;
+        *ptr++ = this->requestID;
+    }
+
+    // Each value has to come out exactly as long as before, otherwise everything around it moves
+    for(const auto& point : t.values){
+        int length = ValueCallback::serialiseValueForCallback(point.callback, image + point.offset, point.length);
+        if(length != (int)point.length) return SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM;
+    }
+
+    t.requestID = this->requestID;
+    memcpy(buf, image, t.encoded.size());
+    return t.encoded.size();
+}
+
+// Steps through an encoded trap alongside the structure it was built from, noting where the changing parts are
+void SNMPTrap::recordTemplate(const uint8_t* buf, size_t length){
+    TrapTemplate& t = encodedTemplate;
+    t.values.clear();
+    t.requestIDOffset = -1;
+
+    const uint8_t* ptr = buf;
+    const uint8_t* end = buf + length;
+    ASN_TYPE type;
+    size_t valueLength;
+    int i;
+
+#define TEMPLATE_HEADER() \
+    i = decode_ber_header(ptr, end - ptr, &type, &valueLength); \
+    if(i < 0 || valueLength > (size_t)(end - ptr - i)) return;
+
+    // Message, version and community
+    TEMPLATE_HEADER();
+    ptr += i;
+    for(int field = 0; field < 2; field++){
+        TEMPLATE_HEADER();
+        ptr += i + valueLength;
+    }
+
+    // PDU
+    TEMPLATE_HEADER();
+    ptr += i;
+
+    int requestIDOffset = -1;
+    std::vector<PatchPoint> values;
+    if(this->snmpVersion == SNMP_VERSION_1){
+        // enterprise, agent address, generic and specific trap
+        for(int field = 0; field < 4; field++){
+            TEMPLATE_HEADER();
+            ptr += i + valueLength;
+        }
+        TEMPLATE_HEADER();
+        if(uptimeCallback) values.push_back({(size_t)(ptr - buf), i + valueLength, uptimeCallback});
+        ptr += i + valueLength;
+    } else {
+        TEMPLATE_HEADER();
+        if(type != INTEGER || valueLength != 4) return;
+        requestIDOffset = ptr + i - buf;
+        ptr += i + valueLength;
+        // error status and index
+        for(int field = 0; field < 2; field++){
+            TEMPLATE_HEADER();
+            ptr += i + valueLength;
+        }
+    }
+
+    // Varbind list, v2 starts with uptime and the trap OID before our callbacks
+    TEMPLATE_HEADER();
+    ptr += i;
+
+    auto callback = this->callbacks.begin();
+    for(int varbind = 0; ptr < end; varbind++){
+        TEMPLATE_HEADER();
+        ptr += i;
+        // OID
+        TEMPLATE_HEADER();
+        ptr += i + valueLength;
+        TEMPLATE_HEADER();
+
+        ValueCallback* patchWith = nullptr;
+        if(this->snmpVersion == SNMP_VERSION_1 || varbind >= 2){
+            while(callback != this->callbacks.end() && !*callback) ++callback;
+            if(callback == this->callbacks.end()) return;
+            patchWith = *callback++;
+        } else if(varbind == 0){
+            patchWith = uptimeCallback;
+        }
+        if(patchWith) values.push_back({(size_t)(ptr - buf), i + valueLength, patchWith});
+        ptr += i + valueLength;
+    }
+#undef TEMPLATE_HEADER
+
+    t.encoded.assign(buf, buf + length);
+    t.requestIDOffset = requestIDOffset;
+    t.requestID = this->requestID;
+    t.values.swap(values);
+
+    t.community = this->communityString;
+    t.version = this->snmpVersion;
+    t.pduType = this->packetPDUType;
+    t.trapOID = this->trapOID ? this->trapOID->cloneOID() : nullptr;
+    t.agentIP = this->agentIP;
+    t.genericTrap = this->genericTrap;
+    t.specificTrap = this->specificTrap;
+    t.uptimeCallback = this->uptimeCallback;
+    t.callbacks = this->callbacks;
+}
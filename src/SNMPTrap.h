@@ -5,13 +5,15 @@
 #define SNMPTrap_h
 
 #include <list>
+#include <string>
+#include <vector>
 #include "include/ValueCallbacks.h"
 #include "include/defs.h"
 #include "include/SNMPPacket.h"
 
 #include <stdlib.h>
 
-#ifdef COMPILING_TESTS
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
 	#include "tests/required/IPAddress.h"
 	#include "tests/required/UDP.h"
 #else
@@ -113,32 +115,53 @@ class SNMPTrap : public SNMPPacket {
         }
     }
 
-    bool sendTo(const IPAddress& ip, bool skipBuild = false){
-        bool buildStatus = true;
-        if(!skipBuild) {
-            buildStatus = this->buildForSending();
-        }
+    // Starts a fresh send like buildForSending(), but encodes straight into buf, returning the length.
+    // Once a trap has been encoded, later sends just patch the new requestID, uptime and values into a copy of it,
+    // falling back to a full build whenever the trap's been changed or a value no longer encodes to the same length
+    int encodeForSending(uint8_t* buf, size_t max_len);
+
+    // Where the requestID's 4 value bytes sit in what encodeForSending() last gave back, -1 for v1 traps
+    int encodedRequestIDOffset() const {
+        return encodedTemplate.requestIDOffset;
+    }
 
+    bool sendTo(const IPAddress& ip, bool skipBuild = false){
         if(!_udp){
             return false;
         }
 
-        if(!this->packet){
-            return false;
+        uint8_t _packetBuffer[MAX_SNMP_PACKET_LENGTH];
+        int length;
+        if(skipBuild){
+            length = serialiseLastEncoded(_packetBuffer, MAX_SNMP_PACKET_LENGTH);
+        } else {
+            length = encodeForSending(_packetBuffer, MAX_SNMP_PACKET_LENGTH);
         }
 
-        if(!buildStatus){
+        if(length <= 0){
             SNMP_LOGW("Failed Building packet..");
             return false;
         }
 
-        uint8_t _packetBuffer[MAX_SNMP_PACKET_LENGTH] = {0};
-        int length = packet->serialise(_packetBuffer, MAX_SNMP_PACKET_LENGTH);
+        return sendPacket(_packetBuffer, length, ip);
+    }
+
+    // Encodes whatever was last built by buildForSending(), so it can be kept and resent as is
+    int serialiseBuilt(uint8_t* buf, size_t max_len){
+        if(!this->packet) return SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM;
+        return this->packet->serialise(buf, max_len);
+    }
+
+    // What was last got ready for sending, as it was sent: the template if encodeForSending() patched it since the
+    // last buildForSending(), which leaves the built packet holding an older requestID and values, otherwise the built packet
+    int serialiseLastEncoded(uint8_t* buf, size_t max_len);
 
-        if(length <= 0) return false;
+    // Sends an already encoded trap
+    bool sendPacket(const uint8_t* buf, size_t length, const IPAddress& ip){
+        if(!_udp) return false;
 
         _udp->beginPacket(ip, trapUDPport);
-        _udp->write(_packetBuffer, length);
+        _udp->write(buf, length);
         return _udp->endPacket();
     }
 
@@ -151,6 +174,38 @@ class SNMPTrap : public SNMPPacket {
     OIDType* snmpTrapOID  = new OIDType(".1.3.6.1.2.1.1.2.0");
 
     bool build() override;
+
+  private:
+    // A value in the template that's re-encoded for every send, always the whole TLV
+    struct PatchPoint {
+        size_t offset;
+        size_t length;
+        ValueCallback* callback;
+    };
+
+    struct TrapTemplate {
+        // Patched in place, so it's always exactly what was last sent from it
+        std::vector<uint8_t> encoded;
+        int requestIDOffset = -1;
+        snmp_request_id_t requestID = 0;
+        std::vector<PatchPoint> values;
+
+        // What the trap looked like when it was encoded, if any of it changes the template's no good
+        std::string community;
+        SNMP_VERSION version = SNMP_VERSION_MAX;
+        ASN_TYPE pduType = NULLTYPE;
+        // Copies, as trapOID and callbacks can both be changed in place (or freed and another put at the same address)
+        std::shared_ptr<OIDType> trapOID;
+        IPAddress agentIP;
+        short genericTrap = 0;
+        short specificTrap = 0;
+        TimestampCallback* uptimeCallback = nullptr;
+        std::list<ValueCallback*> callbacks;
+    } encodedTemplate;
+
+    bool templateMatches() const;
+    void recordTemplate(const uint8_t* buf, size_t length);
+    int patchTemplate(uint8_t* buf, size_t max_len);
 };
 
 #endif
@@ -0,0 +1,127 @@
+#include "include/SNMPTrapQueue.h"
+
+#include <algorithm>
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
+    #include <tests/required/millis.h>
+#endif
+
+size_t TrapQueue::size() const {
+    size_t count = 0;
+    for(const auto& level : items) count += level.size();
+    return count;
+}
+
+bool trap_queue_push(TrapQueue &trapQueue, SNMPTrap* trap, const std::vector<IPAddress>& ips, SNMP_TRAP_PRIORITY priority,
+                     bool replaceQueuedRequests, int retries, int delay_ms) {
+    if(ips.empty()){
+        SNMP_LOGW("Not queueing a trap with no receivers\n");
+        return false;
+    }
+    if(priority < SNMP_TRAP_PRIORITY_LOW || priority >= SNMP_TRAP_PRIORITY_COUNT){
+        priority = SNMP_TRAP_PRIORITY_NORMAL;
+    }
+
+    // Already waiting, take the newest settings and any new receivers, and move it up if this send matters more
+    for(int level = 0; level < SNMP_TRAP_PRIORITY_COUNT; level++){
+        auto& queue = trapQueue.items[level];
+        for(auto it = queue.begin(); it != queue.end(); ++it){
+            if(it->trap != trap) continue;
+
+            for(const auto& ip : ips){
+                if(std::find(it->ips.begin(), it->ips.end(), ip) == it->ips.end()){
+                    it->ips.push_back(ip);
+                }
+            }
+            it->replaceQueuedRequests = replaceQueuedRequests;
+            it->retries = retries;
+            it->delay_ms = delay_ms;
+
+            if(level < priority){
+                trapQueue.items[priority].push_back(*it);
+                queue.erase(it);
+            }
+            trapQueue.stats.coalesced++;
+            return true;
+        }
+    }
+
+    if(trapQueue.size() >= trapQueue.maxItems){
+        int level = 0;
+        while(level < priority && trapQueue.items[level].empty()) level++;
+        if(level >= priority){
+            SNMP_LOGW("Trap queue full, dropping trap\n");
+            trapQueue.stats.dropped++;
+            return false;
+        }
+        SNMP_LOGW("Trap queue full, dropping a lower priority trap\n");
+        trapQueue.items[level].pop_front();
+        trapQueue.stats.dropped++;
+    }
+
+    trapQueue.items[priority].push_back({trap, ips, replaceQueuedRequests, retries, delay_ms});
+    trapQueue.stats.queued++;
+    return true;
+}
+
+TrapQueueItem* trap_queue_front(TrapQueue &trapQueue) {
+    for(int level = SNMP_TRAP_PRIORITY_COUNT - 1; level >= 0; level--){
+        if(!trapQueue.items[level].empty()) return &trapQueue.items[level].front();
+    }
+    return nullptr;
+}
+
+void trap_queue_pop(TrapQueue &trapQueue) {
+    for(int level = SNMP_TRAP_PRIORITY_COUNT - 1; level >= 0; level--){
+        if(!trapQueue.items[level].empty()){
+            trapQueue.items[level].pop_front();
+            return;
+        }
+    }
+}
+
+void trap_queue_remove(TrapQueue &trapQueue, SNMPTrap* trap) {
+    for(auto& queue : trapQueue.items){
+        queue.erase(std::remove_if(queue.begin(), queue.end(), [trap](const TrapQueueItem& item){
+            return item.trap == trap;
+        }), queue.end());
+    }
+}
+
+void trap_queue_set_rate(TrapQueue &trapQueue, unsigned int ratePerSecond, unsigned int burst) {
+    trapQueue.ratePerSecond = ratePerSecond;
+    trapQueue.burst = burst ? burst : 1;
+    // Start full, so the first burst goes straight out
+    trapQueue.tokens = (unsigned long)trapQueue.burst * 1000;
+    trapQueue.lastRefill = millis();
+}
+
+static unsigned long available_tokens(const TrapQueue &trapQueue, unsigned long now) {
+    unsigned long full = (unsigned long)trapQueue.burst * 1000;
+    unsigned long elapsed = now - trapQueue.lastRefill;
+    // Full by then anyway, and it stops the multiply below overflowing
+    if(elapsed > full / trapQueue.ratePerSecond) return full;
+
+    unsigned long tokens = trapQueue.tokens + elapsed * trapQueue.ratePerSecond;
+    return tokens < full ? tokens : full;
+}
+
+size_t trap_queue_take_tokens(TrapQueue &trapQueue, size_t wanted) {
+    if(!trapQueue.ratePerSecond) return wanted;
+
+    unsigned long now = millis();
+    trapQueue.tokens = available_tokens(trapQueue, now);
+    trapQueue.lastRefill = now;
+
+    size_t allowed = std::min(wanted, (size_t)(trapQueue.tokens / 1000));
+    trapQueue.tokens -= allowed * 1000;
+    return allowed;
+}
+
+long trap_queue_timeout(const TrapQueue &trapQueue) {
+    if(!trapQueue.size()) return -1;
+    if(!trapQueue.ratePerSecond) return 0;
+
+    unsigned long tokens = available_tokens(trapQueue, millis());
+    if(tokens >= 1000) return 0;
+    return (1000 - tokens + trapQueue.ratePerSecond - 1) / trapQueue.ratePerSecond;
+}
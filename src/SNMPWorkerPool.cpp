@@ -0,0 +1,126 @@
+#include "SNMPWorkerPool.h"
+
+#ifdef SNMP_LINUX_UDP
+
+// Get, GetNext and GetBulk only read from the handlers, anything else has to take the write lock
+static bool is_read_only_request(const uint8_t* buffer, int length){
+    const uint8_t* ptr = buffer;
+    const uint8_t* end = buffer + length;
+    ASN_TYPE type;
+    size_t valueLength;
+
+    int i = decode_ber_header(ptr, end - ptr, &type, &valueLength);
+    if(i < 0 || type != STRUCTURE) return false;
+    ptr += i;
+
+    // version and community
+    for(int field = 0; field < 2; field++){
+        i = decode_ber_header(ptr, end - ptr, &type, &valueLength);
+        if(i < 0) return false;
+        ptr += i + valueLength;
+    }
+
+    i = decode_ber_header(ptr, end - ptr, &type, &valueLength);
+    if(i < 0) return false;
+    return type == GetRequestPDU || type == GetNextRequestPDU || type == GetBulkRequestPDU;
+}
+
+bool SNMPWorkerPool::start(int port){
+    if(isRunning()) return false;
+    stopping = false;
+    agent.handlers.publish();
+
+    for(unsigned int i = 0; i < workerCount; i++){
+        Worker* worker = new Worker(batchSize);
+        workers.push_back(std::unique_ptr<Worker>(worker));
+
+        worker->udp.setReusePort(true);
+        worker->udp.begin(port);
+        if(worker->udp.fd() < 0){
+            SNMP_LOGW("Failed to open socket for worker %d\n", i);
+            stop();
+            return false;
+        }
+        // The rest have to share whichever port the first one was given
+        if(port == 0) port = worker->udp.localPort();
+    }
+
+    // Only start them once every socket is bound, so a failure doesn't leave some running
+    for(auto& worker : workers){
+        worker->thread = std::thread(&SNMPWorkerPool::run, this, worker.get());
+    }
+    return true;
+}
+
+void SNMPWorkerPool::stop(){
+    stopping = true;
+    for(auto& worker : workers){
+        if(worker->thread.joinable()){
+            worker->thread.join();
+        }
+        worker->udp.stop();
+    }
+    workers.clear();
+}
+
+SNMPSocketStats SNMPWorkerPool::getStats() const {
+    SNMPSocketStats stats;
+    for(auto& worker : workers){
+        stats.received += worker->received;
+        stats.sent += worker->udp.datagramsSent();
+        stats.dropped += worker->dropped + worker->udp.datagramsFailed();
+    }
+    return stats;
+}
+
+void SNMPWorkerPool::run(Worker* worker){
+    while(!stopping){
+        // Wake up every so often to check whether we've been stopped
+        if(!worker->udp.waitForPacket(100)) continue;
+
+        int packetLength;
+        while((packetLength = worker->udp.parsePacket()) > 0){
+            handle(worker, packetLength);
+        }
+    }
+}
+
+void SNMPWorkerPool::handle(Worker* worker, int packetLength){
+    worker->received++;
+
+    if(packetLength > MAX_SNMP_PACKET_LENGTH){
+        SNMP_LOGW("Incoming packet too large: %d\n", packetLength);
+        worker->dropped++;
+        return;
+    }
+
+    if(worker->udp.read(worker->packetBuffer, packetLength) != packetLength){
+        worker->dropped++;
+        return;
+    }
+
+    int responseLength = 0;
+    SNMP_ERROR_RESPONSE response;
+    SNMPHandlerRegistry::Reader reader(agent.handlers);
+    if(is_read_only_request(worker->packetBuffer, packetLength)){
+        response = handlePacket(worker->packetBuffer, packetLength, &responseLength, MAX_SNMP_PACKET_LENGTH, reader.callbacks(), agent._community, agent._readOnlyCommunity);
+    } else {
+        std::lock_guard<std::mutex> lock(writeLock);
+        // Inform responses are only queued here, the agent's own thread matches them next time it handles its informs
+        response = handlePacket(worker->packetBuffer, packetLength, &responseLength, MAX_SNMP_PACKET_LENGTH, reader.callbacks(), agent._community, agent._readOnlyCommunity, SNMPAgent::deferredInformCallback, (void*)&agent);
+        if(response == SNMP_SET_OCCURRED){
+            agent.setOccurred = true;
+        }
+    }
+
+    if(response > 0 && response != SNMP_INFORM_RESPONSE_OCCURRED){
+        worker->udp.beginPacket(worker->udp.remoteIP(), worker->udp.remotePort());
+        worker->udp.write(worker->packetBuffer, responseLength);
+        // Whether it goes out now or with the rest of the batch, the socket counts it as sent or failed when it does
+        worker->udp.endPacket();
+    } else if(response < 0){
+        worker->dropped++;
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SNMPWorkerPool_h
+#define SNMPWorkerPool_h
+
+#include "SNMP_Agent.h"
+
+#ifdef SNMP_LINUX_UDP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Serves an SNMPAgent's handlers from several threads at once, for agents running on a Linux host.
+// Each worker has its own SO_REUSEPORT socket bound to the same port (so the kernel spreads requests across them)
+// and its own packet buffer, and they all read the agent's handlers directly.
+//
+// Get, GetNext and GetBulk requests run concurrently, so any dynamic handler functions have to be safe to call from several threads.
+// Sets change shared state, so they're handled one at a time. Inform responses are handed back to the agent, whose own
+// thread matches them the next time its loop() or onTimer() runs, since that's the only thread that touches its informs.
+// Handlers can be added, removed or sorted while the pool is running, but ones added only show up after sortHandlers().
+class SNMPWorkerPool {
+  public:
+    SNMPWorkerPool(SNMPAgent& agent, unsigned int workers, unsigned int batchSize = 32): agent(agent), workerCount(workers ? workers : 1), batchSize(batchSize){};
+    ~SNMPWorkerPool(){ stop(); }
+
+    // Returns false (with nothing left running) if any of the sockets couldn't be bound.
+    // Port 0 binds whichever port is free, port() says which
+    bool start(int port);
+    void stop();
+
+    bool isRunning() const { return !workers.empty(); }
+    int port() const { return workers.empty() ? 0 : workers[0]->udp.localPort(); }
+
+    // Totals across every worker's socket
+    SNMPSocketStats getStats() const;
+
+  private:
+    struct Worker {
+        Worker(unsigned int batchSize): udp(batchSize){};
+
+        LinuxUDP udp;
+        std::thread thread;
+        uint8_t packetBuffer[MAX_SNMP_PACKET_LENGTH];
+
+        // Sent responses are counted by the socket, as they leave
+        std::atomic<unsigned long> received{0};
+        std::atomic<unsigned long> dropped{0};
+    };
+
+    SNMPAgent& agent;
+    const unsigned int workerCount;
+    const unsigned int batchSize;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopping{false};
+    std::mutex writeLock;
+
+    void run(Worker* worker);
+    void handle(Worker* worker, int packetLength);
+};
+
+#endif
+#endif
@@ -1,12 +1,56 @@
 #include "SNMP_Agent.h"
 
+#include <algorithm>
+#include <stdio.h>
+
 const char* SNMP_TAG = "SNMP";
 
 void SNMPAgent::setUDP(UDP* udp){
-    this->_udp.push_back(udp);
+    UDPSocket socket;
+    socket.udp = udp;
+#ifdef SNMP_LINUX_UDP
+    socket.batched = nullptr;
+    socket.unsent = 0;
+    socket.seenSent = 0;
+    socket.seenFailed = 0;
+#endif
+    this->_udp.push_back(socket);
     this->begin();
 }
 
+#ifdef SNMP_LINUX_UDP
+void SNMPAgent::setUDP(LinuxUDP* udp){
+    this->setUDP(static_cast<UDP*>(udp));
+    this->_udp.back().batched = udp;
+    this->_udp.back().seenSent = udp->datagramsSent();
+    this->_udp.back().seenFailed = udp->datagramsFailed();
+}
+#endif
+
+void SNMPAgent::flushUDP(UDPSocket& socket){
+#ifdef SNMP_LINUX_UDP
+    if(!socket.batched) return;
+    socket.batched->flush();
+
+    // Responses only count once they've actually left. Traps sent over the same socket show up in its totals too,
+    // but they're counted when they're sent, so anything beyond the responses we handed it isn't ours
+    unsigned long sent = socket.batched->datagramsSent() - socket.seenSent;
+    unsigned long failed = socket.batched->datagramsFailed() - socket.seenFailed;
+    socket.seenSent += sent;
+    socket.seenFailed += failed;
+
+    sent = std::min(sent, socket.unsent);
+    failed = std::min(failed, socket.unsent - sent);
+    socket.unsent = 0;
+
+    socket.stats.sent += sent;
+    socket.stats.dropped += failed;
+    stats.count(SNMP_OUT_PKTS, sent);
+#else
+    (void)socket;
+#endif
+}
+
 void SNMPAgent::begin(){
     this->restartUDP();
 }
@@ -17,56 +61,192 @@ void SNMPAgent::begin(const char* prefix){
 }
 
 void SNMPAgent::stop(){
-    for(auto udp : _udp){
-        udp->stop();
+    for(auto& socket : _udp){
+        socket.udp->stop();
     }
 }
 
-SNMP_ERROR_RESPONSE SNMPAgent::loop(){
-    for(auto udp : _udp){
-        int packetLength = udp->parsePacket();
-        if(packetLength > 0){
-            SNMP_LOGD("Received packet from: %s, of size: %d", udp->remoteIP().toString().c_str(), packetLength);
+SNMP_ERROR_RESPONSE SNMPAgent::handleUDPPacket(UDPSocket& socket, int packetLength){
+    UDP* udp = socket.udp;
+    socket.stats.received++;
+    SNMP_LOGD("Received packet from: %s, of size: %d", udp->remoteIP().toString().c_str(), packetLength);
+
+    if(packetLength < 0 || packetLength > MAX_SNMP_PACKET_LENGTH){
+        SNMP_LOGW("Incoming packet too large: %d\n", packetLength);
+        socket.stats.dropped++;
+        // Never gets as far as handlePacket, but it still arrived and we couldn't decode it
+        stats.count(SNMP_IN_PKTS);
+        stats.count(SNMP_IN_ASN_PARSE_ERRS);
+        return SNMP_REQUEST_TOO_LARGE;
+    }
 
-            if(packetLength < 0 || packetLength > MAX_SNMP_PACKET_LENGTH){
-                SNMP_LOGW("Incoming packet too large: %d\n", packetLength);
-                return SNMP_REQUEST_TOO_LARGE;
-            }
+    // Only the first packetLength bytes are valid from here on, nothing reads past them so there's no need to clear the rest
+    int readBytes = udp->read(_packetBuffer, packetLength);
+    if(readBytes != packetLength){
+        SNMP_LOGW("Packet length mismatch: expected: %d, actual: %d\n", packetLength, readBytes);
+        socket.stats.dropped++;
+        return SNMP_REQUEST_INVALID;
+    }
 
-            memset(_packetBuffer, 0, MAX_SNMP_PACKET_LENGTH);
+    unsigned long requestStart = stats.timeLatency ? micros() : 0;
+    int responseLength = 0;
+    SNMPHandlerRegistry::Reader reader(handlers);
+    SNMP_ERROR_RESPONSE response = handlePacket(_packetBuffer, packetLength, &responseLength, MAX_SNMP_PACKET_LENGTH, reader.callbacks(), _community, _readOnlyCommunity, informCallback, (void*)this, &stats);
+    if(response > 0 && response != SNMP_INFORM_RESPONSE_OCCURRED){
+        // send it
+        SNMP_LOGD("Built packet, sending back response to: %s, %d\n", udp->remoteIP().toString().c_str(), udp->remotePort());
+        unsigned long sendStart = stats.timeLatency ? micros() : 0;
+        udp->beginPacket(udp->remoteIP(), udp->remotePort());
+        udp->write(_packetBuffer, responseLength);
+
+        int ended = udp->endPacket();
+#ifdef SNMP_LINUX_UDP
+        if(socket.batched){
+            // Might still be waiting in the batch, flushUDP() counts it once it's gone out (or couldn't)
+            socket.unsent++;
+        } else
+#endif
+        if(ended){
+            socket.stats.sent++;
+            stats.count(SNMP_OUT_PKTS);
+        } else {
+            SNMP_LOGW("Failed to send response packet\n");
+            socket.stats.dropped++;
+        }
+        stats.lap(SNMP_LATENCY_SEND, sendStart);
+        stats.lap(SNMP_LATENCY_TOTAL, requestStart);
+    } else if(response < 0){
+        socket.stats.dropped++;
+    }
 
-            int readBytes = udp->read(_packetBuffer, packetLength);
-            if(readBytes != packetLength){
-                SNMP_LOGW("Packet length mismatch: expected: %d, actual: %d\n", packetLength, readBytes);
-                return SNMP_REQUEST_INVALID;
-            }
+    if(response == SNMP_SET_OCCURRED){
+        setOccurred = true;
+    }
 
-            int responseLength = 0;
-            SNMP_ERROR_RESPONSE response = handlePacket(_packetBuffer, packetLength, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks, _community, _readOnlyCommunity, informCallback, (void*)this);
-            if(response > 0 && response != SNMP_INFORM_RESPONSE_OCCURRED){
-                // send it
-                SNMP_LOGD("Built packet, sending back response to: %s, %d\n", udp->remoteIP().toString().c_str(), udp->remotePort());
-                udp->beginPacket(udp->remoteIP(), udp->remotePort());
-                udp->write(_packetBuffer, responseLength);
-
-                if(!udp->endPacket()){
-                    SNMP_LOGW("Failed to send response packet\n");
-                }
-            }
+    return response;
+}
+
+SNMP_ERROR_RESPONSE SNMPAgent::loop(){
+    // Handlers added since the last loop only become visible to requests now
+    handlers.publish();
+
+    size_t count = _udp.size();
+    for(size_t i = 0; i < count; i++){
+        size_t index = (_nextUDP + i) % count;
+        int packetLength = _udp[index].udp->parsePacket();
+        if(packetLength > 0){
+            _nextUDP = (index + 1) % count;
 
-            if(response == SNMP_SET_OCCURRED){
-                setOccurred = true;
+            SNMP_ERROR_RESPONSE response = handleUDPPacket(_udp[index], packetLength);
+            flushUDP(_udp[index]);
+            if(response == SNMP_REQUEST_TOO_LARGE || response == SNMP_REQUEST_INVALID){
+                return response;
             }
 
+            this->handleTrapQueue();
             this->handleInformQueue();
             return response;
         }
     }
     
+    this->handleTrapQueue();
     this->handleInformQueue();
     return SNMP_NO_PACKET;
 }
 
+SNMPLoopResult SNMPAgent::loop(int maxPackets, unsigned long timeBudgetMs){
+    handlers.publish();
+
+    SNMPLoopResult result;
+    unsigned long start = millis();
+    size_t count = _udp.size();
+
+    bool packetWaiting = true;
+    while(packetWaiting){
+        packetWaiting = false;
+
+        for(size_t i = 0; i < count; i++){
+            if(result.packets >= maxPackets || (timeBudgetMs && millis() - start >= timeBudgetMs)){
+                result.budgetExhausted = true;
+                break;
+            }
+
+            size_t index = _nextUDP;
+            _nextUDP = (_nextUDP + 1) % count;
+
+            int packetLength = _udp[index].udp->parsePacket();
+            if(packetLength <= 0) continue;
+
+            packetWaiting = true;
+            result.packets++;
+
+            countResponse(result, handleUDPPacket(_udp[index], packetLength));
+        }
+
+        if(result.budgetExhausted) break;
+    }
+
+    // Anything still held back belongs to a batch we stopped partway through, it shouldn't wait for the next call
+    for(auto& socket : _udp){
+        flushUDP(socket);
+    }
+
+    this->handleTrapQueue();
+    this->handleInformQueue();
+    return result;
+}
+
+void SNMPAgent::countResponse(SNMPLoopResult& result, SNMP_ERROR_RESPONSE response){
+    result.lastResponse = response;
+    if(response > 0 && response != SNMP_INFORM_RESPONSE_OCCURRED){
+        result.responses++;
+    } else if(response < 0){
+        result.errors++;
+    }
+}
+
+#ifdef SNMP_LINUX_UDP
+std::vector<int> SNMPAgent::getFileDescriptors() const {
+    std::vector<int> fds;
+    for(auto& socket : _udp){
+        if(socket.batched && socket.batched->fd() >= 0){
+            fds.push_back(socket.batched->fd());
+        }
+    }
+    return fds;
+}
+
+SNMPLoopResult SNMPAgent::onReadable(int fd){
+    SNMPLoopResult result;
+    handlers.publish();
+
+    for(auto& socket : _udp){
+        if(!socket.batched || (fd >= 0 && socket.batched->fd() != fd)) continue;
+
+        int packetLength;
+        while((packetLength = socket.udp->parsePacket()) > 0){
+            result.packets++;
+            countResponse(result, handleUDPPacket(socket, packetLength));
+        }
+        flushUDP(socket);
+    }
+    return result;
+}
+#endif
+
+long SNMPAgent::nextInformTimeout() const {
+    long informTimeout = next_inform_timeout(this->informQueue);
+    long trapTimeout = trap_queue_timeout(this->trapQueue);
+    if(informTimeout < 0) return trapTimeout;
+    if(trapTimeout < 0) return informTimeout;
+    return std::min(informTimeout, trapTimeout);
+}
+
+void SNMPAgent::onTimer(){
+    this->handleTrapQueue();
+    this->handleInformQueue();
+}
+
 SortableOIDType* SNMPAgent::buildOIDWithPrefix(const char *oid, bool overwritePrefix){
     SortableOIDType* newOid;
     if(!this->oidPrefix.empty() && !overwritePrefix){
@@ -107,6 +287,62 @@ ValueCallback* SNMPAgent::addOpaqueHandler(const char *oid, uint8_t* value, size
     return addHandler(new OpaqueCallback(oidType, value, data_len), isSettable);
 }
 
+bool SNMPAgent::addLatencyHandlers(const char *oid, bool overwritePrefix){
+    stats.timeLatency = true;
+
+    // <oid>.<phase>.1 count, .2/.3/.4 50th/90th/99th percentile, .5 max and .10.<bucket> the histogram itself, all in µs.
+    // Phases are numbered from 1 in the order of SNMP_LATENCY_PHASE
+    static const unsigned int percents[] = { 50, 90, 99 };
+    char suffix[24];
+    bool added = true;
+    for(int phase = 0; phase < SNMP_LATENCY_PHASE_COUNT; phase++){
+        SNMPLatencyHistogram* histogram = &stats.latency[phase];
+
+        snprintf(suffix, sizeof(suffix), ".%d.1", phase + 1);
+        added &= addCounter32Handler((std::string(oid) + suffix).c_str(), &histogram->count, overwritePrefix) != nullptr;
+
+        for(int i = 0; i < 3; i++){
+            snprintf(suffix, sizeof(suffix), ".%d.%d", phase + 1, i + 2);
+            SortableOIDType* oidType = buildOIDWithPrefix((std::string(oid) + suffix).c_str(), overwritePrefix);
+            added &= oidType && addHandler(new LatencyPercentileCallback(oidType, histogram, percents[i]), false);
+        }
+
+        snprintf(suffix, sizeof(suffix), ".%d.5", phase + 1);
+        added &= addGaugeHandler((std::string(oid) + suffix).c_str(), &histogram->max, overwritePrefix) != nullptr;
+
+        for(int bucket = 0; bucket < SNMP_LATENCY_BUCKETS; bucket++){
+            snprintf(suffix, sizeof(suffix), ".%d.10.%d", phase + 1, bucket + 1);
+            added &= addCounter32Handler((std::string(oid) + suffix).c_str(), &histogram->buckets[bucket], overwritePrefix) != nullptr;
+        }
+    }
+    return added;
+}
+
+// The counters defined in the snmp group (RFC 1213 / RFC 3418), the gaps are .7 and .23, which aren't assigned,
+// and .30, snmpEnableAuthenTraps, which isn't a counter
+static const SNMP_MIB_COUNTER snmpGroupCounters[] = {
+    SNMP_IN_PKTS, SNMP_OUT_PKTS, SNMP_IN_BAD_VERSIONS, SNMP_IN_BAD_COMMUNITY_NAMES, SNMP_IN_BAD_COMMUNITY_USES,
+    SNMP_IN_ASN_PARSE_ERRS, SNMP_IN_TOO_BIGS, SNMP_IN_NO_SUCH_NAMES, SNMP_IN_BAD_VALUES, SNMP_IN_READ_ONLYS,
+    SNMP_IN_GEN_ERRS, SNMP_IN_TOTAL_REQ_VARS, SNMP_IN_TOTAL_SET_VARS, SNMP_IN_GET_REQUESTS, SNMP_IN_GET_NEXTS,
+    SNMP_IN_SET_REQUESTS, SNMP_IN_GET_RESPONSES, SNMP_IN_TRAPS, SNMP_OUT_TOO_BIGS, SNMP_OUT_NO_SUCH_NAMES,
+    SNMP_OUT_BAD_VALUES, SNMP_OUT_GEN_ERRS, SNMP_OUT_GET_REQUESTS, SNMP_OUT_GET_NEXTS, SNMP_OUT_SET_REQUESTS,
+    SNMP_OUT_GET_RESPONSES, SNMP_OUT_TRAPS, SNMP_SILENT_DROPS, SNMP_PROXY_DROPS
+};
+
+bool SNMPAgent::addSNMPGroupHandlers(){
+    // Always 1.3.6.1.2.1.11, whatever the prefix
+    char oid[32];
+    bool added = true;
+    for(SNMP_MIB_COUNTER counter : snmpGroupCounters){
+        snprintf(oid, sizeof(oid), ".1.3.6.1.2.1.11.%d.0", (int)counter);
+        added &= addCounter32Handler(oid, &stats.counters[counter], true) != nullptr;
+    }
+
+    // snmpEnableAuthenTraps, we never send authenticationFailure traps so it's always disabled(2)
+    added &= addReadOnlyIntegerHandler(".1.3.6.1.2.1.11.30.0", 2, true) != nullptr;
+    return added;
+}
+
 ValueCallback* SNMPAgent::addIntegerHandler(const char *oid, int* value, bool isSettable, bool overwritePrefix){
     if(!value) return nullptr;
 
@@ -192,47 +428,134 @@ ValueCallback* SNMPAgent::addGaugeHandler(const char *oid, uint32_t* value, bool
 
 ValueCallback * SNMPAgent::addHandler(ValueCallback *callback, bool isSettable) {
     callback->isSettable = isSettable;
-    this->callbacks.push_back(callback);
+    this->handlers.add(callback);
     return callback;
 }
 
 bool SNMPAgent::removeHandler(ValueCallback* callback){ // this will remove the callback from the list and shift everything in the list back so there are no gaps, this will not delete the actual callback
-    remove_handler(this->callbacks, callback);
-    return true;
+    return this->handlers.remove(callback);
 }
 
 bool SNMPAgent::sortHandlers(){
-    sort_handlers(this->callbacks);
-    return true;
+    return this->handlers.sort();
 }
 
 snmp_request_id_t SNMPAgent::sendTrapTo(SNMPTrap* trap, const IPAddress& ip, bool replaceQueuedRequests, int retries, int delay_ms){
-    return queue_and_send_trap(this->informList, trap, ip, replaceQueuedRequests, retries, delay_ms);
+    snmp_request_id_t requestID = queue_and_send_trap(this->informQueue, trap, ip, replaceQueuedRequests, retries, delay_ms);
+    if(requestID != INVALID_SNMP_REQUEST_ID) countTrapsSent(1);
+    return requestID;
+}
+
+int SNMPAgent::sendTrapTo(SNMPTrap* trap, const std::vector<IPAddress>& ips, bool replaceQueuedRequests, int retries, int delay_ms){
+#ifdef SNMP_LINUX_UDP
+    // If the trap goes out over one of our batched sockets, send every receiver's copy with one sendmmsg()
+    LinuxUDP* batched = nullptr;
+    for(auto& socket : _udp){
+        if(socket.batched && socket.udp == trap->_udp) batched = socket.batched;
+    }
+    if(batched) batched->holdSends(true);
+    int sent = queue_and_send_trap_to_all(this->informQueue, trap, ips, replaceQueuedRequests, retries, delay_ms);
+    if(batched) batched->holdSends(false);
+#else
+    int sent = queue_and_send_trap_to_all(this->informQueue, trap, ips, replaceQueuedRequests, retries, delay_ms);
+#endif
+    if(sent > 0) countTrapsSent(sent);
+    return sent;
+}
+
+void SNMPAgent::countTrapsSent(int sent){
+    // Informs are counted here too, retries of them aren't
+    stats.count(SNMP_OUT_TRAPS, sent);
+    stats.count(SNMP_OUT_PKTS, sent);
+}
+
+bool SNMPAgent::queueTrap(SNMPTrap* trap, const IPAddress& ip, SNMP_TRAP_PRIORITY priority, bool replaceQueuedRequests, int retries, int delay_ms){
+    return trap_queue_push(this->trapQueue, trap, std::vector<IPAddress>(1, ip), priority, replaceQueuedRequests, retries, delay_ms);
+}
+
+bool SNMPAgent::queueTrap(SNMPTrap* trap, const std::vector<IPAddress>& ips, SNMP_TRAP_PRIORITY priority, bool replaceQueuedRequests, int retries, int delay_ms){
+    return trap_queue_push(this->trapQueue, trap, ips, priority, replaceQueuedRequests, retries, delay_ms);
+}
+
+void SNMPAgent::handleTrapQueue(){
+    TrapQueueItem* item;
+    while((item = trap_queue_front(this->trapQueue))){
+        size_t allowed = trap_queue_take_tokens(this->trapQueue, item->ips.size());
+        if(!allowed) return;
+
+        if(allowed < item->ips.size()){
+            // Send what we can, the rest of the receivers wait for more tokens and shouldn't cancel these Informs
+            std::vector<IPAddress> ips(item->ips.begin(), item->ips.begin() + allowed);
+            this->trapQueue.stats.sent += sendTrapTo(item->trap, ips, item->replaceQueuedRequests, item->retries, item->delay_ms);
+            item->ips.erase(item->ips.begin(), item->ips.begin() + allowed);
+            item->replaceQueuedRequests = false;
+            return;
+        }
+
+        this->trapQueue.stats.sent += sendTrapTo(item->trap, item->ips, item->replaceQueuedRequests, item->retries, item->delay_ms);
+        trap_queue_pop(this->trapQueue);
+    }
 }
 
 void SNMPAgent::informCallback(void* ctx, snmp_request_id_t requestID, bool responseReceiveSuccess){
     if(!ctx) return;
     SNMPAgent* agent = static_cast<SNMPAgent*>(ctx);
 
-    return inform_callback(agent->informList, requestID, responseReceiveSuccess);
+    return inform_callback(agent->informQueue, requestID, responseReceiveSuccess);
+}
+
+#ifdef SNMP_LINUX_UDP
+void SNMPAgent::deferredInformCallback(void* ctx, snmp_request_id_t requestID, bool responseReceiveSuccess){
+    if(!ctx) return;
+    static_cast<SNMPAgent*>(ctx)->informAcks.push(requestID, responseReceiveSuccess);
+}
+
+void SNMPInformAcks::push(snmp_request_id_t requestID, bool responseReceiveSuccess){
+    std::lock_guard<std::mutex> guard(lock);
+    waiting.push_back(std::make_pair(requestID, responseReceiveSuccess));
+}
+
+void SNMPInformAcks::drainInto(InformQueue& informQueue){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(waiting.empty()) return;
+        // Both keep their capacity, so once warm neither side allocates
+        waiting.swap(draining);
+    }
+    for(const auto& ack : draining){
+        inform_callback(informQueue, ack.first, ack.second);
+    }
+    draining.clear();
 }
+#endif
 
 void SNMPAgent::handleInformQueue(){
-    handle_inform_queue(this->informList);
+#ifdef SNMP_LINUX_UDP
+    informAcks.drainInto(this->informQueue);
+#endif
+    handle_inform_queue(this->informQueue);
 }
 
 void SNMPAgent::markTrapDeleted(SNMPTrap* trap){
     for(auto agent : SNMPAgent::agents){
-        mark_trap_deleted(agent->informList, trap);
+        mark_trap_deleted(agent->informQueue, trap);
+        trap_queue_remove(agent->trapQueue, trap);
     }
 }
 
 std::list<SNMPAgent*> SNMPAgent::agents = std::list<SNMPAgent*>();
 
 bool SNMPAgent::restartUDP() {
-    for(auto udp : _udp){
-        udp->stop();
-        udp->begin(AgentUDPport);
+    for(auto& socket : _udp){
+        socket.udp->stop();
+        socket.udp->begin(AgentUDPport);
     }
     return true;
 }
+
+const SNMPSocketStats* SNMPAgent::getSocketStats(UDP* udp) const {
+    for(auto& socket : _udp){
+        if(socket.udp == udp) return &socket.stats;
+    }
+    return nullptr;
+}
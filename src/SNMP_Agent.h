@@ -1,10 +1,11 @@
 #ifndef SNMPAgent_h
 #define SNMPAgent_h
 
-#ifdef COMPILING_TESTS
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
 	#include "tests/required/millis.h"
 	#include "tests/required/IPAddress.h"
 	#include "tests/required/UDP.h"
+	#include "LinuxUDP.h"
 #else
 	#include <Arduino.h>
 	#include "IPAddress.h"
@@ -22,13 +23,70 @@
 #include "SNMPTrap.h"
 #include "include/SNMPResponse.h"
 #include "include/ValueCallbacks.h"
+#include "include/HandlerRegistry.h"
 #include "include/SNMPParser.h"
 #include "include/defs.h"
 #include "include/SNMPInform.h"
+#include "include/SNMPTrapQueue.h"
 
+#include <atomic>
 #include <list>
 #include <deque>
+#include <vector>
 #include <string>
+#ifdef SNMP_LINUX_UDP
+    #include <mutex>
+#endif
+
+// What a call to SNMPAgent::loop(maxPackets, timeBudgetMs) got through
+struct SNMPLoopResult {
+    int packets = 0;        // datagrams read off the sockets
+    int responses = 0;      // responses sent back
+    int errors = 0;         // packets that were dropped or couldn't be answered
+    bool budgetExhausted = false; // stopped early with packets possibly still waiting
+    SNMP_ERROR_RESPONSE lastResponse = SNMP_NO_PACKET;
+};
+
+// A std::atomic<bool>, so a worker pool thread can set it while the agent's thread reads it, that can still be copied
+// (along with the agent it's in, as in SNMPAgent snmp = SNMPAgent(...))
+class SNMPAtomicFlag {
+  public:
+    SNMPAtomicFlag(bool value = false): value(value){}
+    SNMPAtomicFlag(const SNMPAtomicFlag& other): value(other.value.load()){}
+    SNMPAtomicFlag& operator=(const SNMPAtomicFlag& other){ value = other.value.load(); return *this; }
+    SNMPAtomicFlag& operator=(bool set){ value = set; return *this; }
+    operator bool() const { return value; }
+
+  private:
+    std::atomic<bool> value;
+};
+
+#ifdef SNMP_LINUX_UDP
+// Inform responses taken by worker pool threads, waiting for the agent's own thread to match them against its
+// InformQueue, which nothing else locks. A copied agent starts without any
+class SNMPInformAcks {
+  public:
+    SNMPInformAcks(){}
+    SNMPInformAcks(const SNMPInformAcks&){}
+    SNMPInformAcks& operator=(const SNMPInformAcks&){ return *this; }
+
+    void push(snmp_request_id_t requestID, bool responseReceiveSuccess);
+    // Hands everything waiting to inform_callback(), without holding the lock while it does
+    void drainInto(InformQueue& informQueue);
+
+  private:
+    std::mutex lock;
+    std::vector<std::pair<snmp_request_id_t, bool>> waiting;
+    std::vector<std::pair<snmp_request_id_t, bool>> draining;
+};
+#endif
+
+// Running totals for one socket given to SNMPAgent::setUDP()
+struct SNMPSocketStats {
+    unsigned long received = 0; // datagrams read off the socket
+    unsigned long sent = 0;     // responses sent back out of it
+    unsigned long dropped = 0;  // datagrams that were rejected, or whose response couldn't be built or sent
+};
 
 class SNMPAgent {
     public:
@@ -73,9 +131,24 @@ class SNMPAgent {
             return addGaugeHandler(oid, value, overwritePrefix);
         }
 
+        // Times every request (decode, permission check, dispatch, encode and send, and the whole thing), and serves
+        // the latency histograms and percentiles from under oid, see the .cpp for the layout
+        bool addLatencyHandlers(const char *oid, bool overwritePrefix = false);
+        // Serves the snmp group (1.3.6.1.2.1.11, RFC 1213/3418) from the counters in getStats(), which are kept whether this is called or not
+        bool addSNMPGroupHandlers();
+        const SNMPAgentStats& getStats() const {
+            return stats;
+        }
+
         void
         setUDP(UDP* udp);
+#ifdef SNMP_LINUX_UDP
+        // Lets the agent flush responses held back for a batch once it's done with it (and after every packet in the single packet loop())
+        void setUDP(LinuxUDP* udp);
+#endif
         bool restartUDP();
+        // nullptr if the socket was never given to setUDP()
+        const SNMPSocketStats* getSocketStats(UDP* udp) const;
 
         void
         begin();
@@ -83,31 +156,94 @@ class SNMPAgent {
         begin(const char* oidPrefix);
         void stop();
 	    enum SNMP_ERROR_RESPONSE loop();
+        // Drains every waiting packet across all sockets, taking one from each in turn, until none are left,
+        // maxPackets have been handled or timeBudgetMs has passed (0 for no time limit)
+        SNMPLoopResult loop(int maxPackets, unsigned long timeBudgetMs = 0);
+
+        // For driving the agent from an external event loop instead of polling loop()
+#ifdef SNMP_LINUX_UDP
+        // The sockets of every LinuxUDP given to setUDP(), to watch for readability
+        std::vector<int> getFileDescriptors() const;
+        // Handles every datagram waiting on the socket with this fd (or on all of them for -1), never blocks
+        SNMPLoopResult onReadable(int fd = -1);
+#endif
+        // How long until onTimer() next needs to be called to resend Informs or send queued traps, in ms, or -1 if there's nothing waiting
+        long nextInformTimeout() const;
+        void onTimer();
         
         short AgentUDPport = 161;
         void setUDPport(short port){
 	        AgentUDPport = port;
         }
         
-        bool setOccurred = false;
+        // Also set by a worker pool's threads
+        SNMPAtomicFlag setOccurred;
         void resetSetOccurred(){
             setOccurred = false;
         }
 
+        // Both return false if called from inside a handler, where they'd wait on themselves; removeHandler() also if it wasn't there
         bool removeHandler(ValueCallback* callback);
         bool sortHandlers();
 
         snmp_request_id_t sendTrapTo(SNMPTrap* trap, const IPAddress& ip, bool replaceQueuedRequests = true, int retries = 0, int delay_ms = 30000);
+        // Sends the same trap to every receiver, built and encoded once. Informs each get their own requestID, returns how many were sent
+        int sendTrapTo(SNMPTrap* trap, const std::vector<IPAddress>& ips, bool replaceQueuedRequests = true, int retries = 0, int delay_ms = 30000);
+
+        // Queues the trap to be sent from loop(), paced by setTrapRateLimit(). Queuing a trap that's already waiting just adds
+        // the receivers to it, returns false if the queue was full of traps at least as important, or there were no receivers
+        bool queueTrap(SNMPTrap* trap, const IPAddress& ip, SNMP_TRAP_PRIORITY priority = SNMP_TRAP_PRIORITY_NORMAL, bool replaceQueuedRequests = true, int retries = 0, int delay_ms = 30000);
+        bool queueTrap(SNMPTrap* trap, const std::vector<IPAddress>& ips, SNMP_TRAP_PRIORITY priority = SNMP_TRAP_PRIORITY_NORMAL, bool replaceQueuedRequests = true, int retries = 0, int delay_ms = 30000);
+        // Datagrams per second sent from the queue, with up to burst at once. 0 sends everything queued on the next loop()
+        void setTrapRateLimit(unsigned int perSecond, unsigned int burst = 1){
+            trap_queue_set_rate(trapQueue, perSecond, burst);
+        }
+        void setTrapQueueLength(size_t maxTraps){
+            trapQueue.maxItems = maxTraps;
+        }
+        size_t queuedTraps() const {
+            return trapQueue.size();
+        }
+        const SNMPTrapQueueStats& getTrapQueueStats() const {
+            return trapQueue.stats;
+        }
         static void markTrapDeleted(SNMPTrap* trap);
         
     private:
-        std::deque<ValueCallback*> callbacks;
+        friend class SNMPWorkerPool;
+
+        SNMPHandlerRegistry handlers;
+        SNMPAgentStats stats;
         ValueCallback* addHandler(ValueCallback *callback, bool isSettable);
         
         static void informCallback(void*, snmp_request_id_t, bool);
+#ifdef SNMP_LINUX_UDP
+        // What a worker pool hands inform responses to instead, they're matched from handleInformQueue()
+        SNMPInformAcks informAcks;
+        static void deferredInformCallback(void*, snmp_request_id_t, bool);
+#endif
         void handleInformQueue();
+        void handleTrapQueue();
+        void countTrapsSent(int sent);
+
+        struct UDPSocket {
+            UDP* udp;
+            SNMPSocketStats stats;
+#ifdef SNMP_LINUX_UDP
+            LinuxUDP* batched;
+            // Responses handed to the batch that flushUDP() hasn't seen go out yet, and how far through the socket's own counts it's got
+            unsigned long unsent;
+            unsigned long seenSent;
+            unsigned long seenFailed;
+#endif
+        };
+        void flushUDP(UDPSocket& socket);
+        SNMP_ERROR_RESPONSE handleUDPPacket(UDPSocket& socket, int packetLength);
+        static void countResponse(SNMPLoopResult& result, SNMP_ERROR_RESPONSE response);
 
-        std::list<UDP*> _udp;
+        // Sockets are checked round-robin, starting after whichever one last had a packet, so a busy one can't starve the rest
+        std::vector<UDPSocket> _udp;
+        size_t _nextUDP = 0;
 
         std::string oidPrefix;
         uint8_t _packetBuffer[MAX_SNMP_PACKET_LENGTH] = {0};
@@ -115,7 +251,8 @@ class SNMPAgent {
         SortableOIDType* buildOIDWithPrefix(const char *oid, bool overwritePrefix);
 
         static std::list<SNMPAgent*> agents;
-        std::list<struct InformItem*> informList;
+        InformQueue informQueue;
+        TrapQueue trapQueue;
 };
 
 #endif
@@ -1,9 +1,11 @@
 #include "include/ValueCallbacks.h"
 #include "include/BER.h"
+#include "include/AllocStats.h"
 
 #include <algorithm>
 
 #define ASSERT_VALID_VALUE(value) if(!value) return nullptr;
+#define ASSERT_VALID_ENCODE_VALUE(value) if(!value) return SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM;
 
 #define SETTING_NON_SETTABLE_ERROR READ_ONLY
 // If the value to be set is invalid
@@ -14,7 +16,8 @@
 // #define ASSERT_CALLBACK_SETTABLE if(!(static_cast<ValueCallback*>(this)->isSettable)) return SETTING_NON_SETTABLE_ERROR;
 #define ASSERT_CALLBACK_SETTABLE()
 
-ValueCallback* ValueCallback::findCallback(std::deque<ValueCallback*> &callbacks, const OIDType* const oid, bool walk, size_t startAt, size_t *foundAt){
+ValueCallback* ValueCallback::findCallback(const std::deque<ValueCallback*>&callbacks, const OIDType* const oid, bool walk, size_t startAt, size_t *foundAt){
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_LOOKUP);
     bool useNext = false;
 
     for(size_t i = startAt; i < callbacks.size(); i++){
@@ -49,14 +52,38 @@ ValueCallback* ValueCallback::findCallback(std::deque<ValueCallback*> &callbacks
     return nullptr;
 }
 
+ValueCallback* ValueCallback::findCallback(const std::deque<ValueCallback*>&callbacks, const uint8_t* oid, size_t oidLength){
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_LOOKUP);
+    for(auto callback : callbacks){
+        if(callback->OID->equals(oid, oidLength)){
+            return callback;
+        }
+    }
+    return nullptr;
+}
+
 std::shared_ptr<BER_CONTAINER> ValueCallback::getValueForCallback(ValueCallback* callback){
-    SNMP_LOGD("Getting value for callback of OID: %s, type: %d\n", callback->OID->string().c_str(), callback->type);
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_BUILD);
+    SNMP_LOGD("Getting value for callback of OID: %s, type: %d\n", callback->OID->format().c_str(), callback->type);
     auto value = callback->buildTypeWithValue();
     return value;
 }
 
+int ValueCallback::serialiseValueForCallback(ValueCallback* callback, uint8_t* buf, size_t max_len){
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_BUILD);
+    SNMP_LOGD("Serialising value for callback of OID: %s, type: %d\n", callback->OID->format().c_str(), callback->type);
+    return callback->serialiseValue(buf, max_len);
+}
+
+int ValueCallback::serialiseValue(uint8_t* buf, size_t max_len){
+    auto value = this->buildTypeWithValue();
+    ASSERT_VALID_ENCODE_VALUE(value);
+    return value->serialise(buf, max_len);
+}
+
 SNMP_ERROR_STATUS ValueCallback::setValueForCallback(ValueCallback* callback, const std::shared_ptr<BER_CONTAINER> &value){
-    SNMP_LOGD("Setting value for callback of OID: %s\n", callback->OID->string().c_str());
+    SNMP_ALLOC_PHASE_SCOPE(SNMP_ALLOC_BUILD);
+    SNMP_LOGD("Setting value for callback of OID: %s\n", callback->OID->format().c_str());
 
     if(!callback->isSettable){
         return SETTING_NON_SETTABLE_ERROR;
@@ -96,6 +123,16 @@ SNMP_ERROR_STATUS IntegerCallback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int IntegerCallback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+
+    int val = *this->value;
+    if(this->modifier != 0){
+        val /= this->modifier;
+    }
+    return encode_ber_integer(buf, max_len, INTEGER, val);
+}
+
 std::shared_ptr<BER_CONTAINER> TimestampCallback::buildTypeWithValue(){
     ASSERT_VALID_VALUE(this->value);
 
@@ -112,6 +149,12 @@ SNMP_ERROR_STATUS TimestampCallback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int TimestampCallback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+
+    return encode_ber_integer(buf, max_len, TIMESTAMP, *this->value);
+}
+
 std::shared_ptr<BER_CONTAINER> StringCallback::buildTypeWithValue(){
     ASSERT_VALID_VALUE(this->value);
 
@@ -129,6 +172,13 @@ SNMP_ERROR_STATUS StringCallback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int StringCallback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+    ASSERT_VALID_ENCODE_VALUE(*this->value);
+
+    return encode_ber_octets(buf, max_len, STRING, (const uint8_t*)*this->value, strlen(*this->value));
+}
+
 std::shared_ptr<BER_CONTAINER> ReadOnlyStringCallback::buildTypeWithValue(){
     return std::make_shared<OctetType>(this->value);
 }
@@ -152,6 +202,12 @@ SNMP_ERROR_STATUS OpaqueCallback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int OpaqueCallback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+
+    return encode_ber_octets(buf, max_len, OPAQUE, this->value, this->data_len);
+}
+
 std::shared_ptr<BER_CONTAINER> OIDCallback::buildTypeWithValue(){
     auto oid = std::make_shared<OIDType>(this->value);
     if(!oid->valid) return nullptr;
@@ -173,6 +229,12 @@ SNMP_ERROR_STATUS Counter32Callback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int Counter32Callback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+
+    return encode_ber_integer(buf, max_len, COUNTER32, *this->value);
+}
+
 std::shared_ptr<BER_CONTAINER> Gauge32Callback::buildTypeWithValue(){
     ASSERT_VALID_VALUE(this->value);
 
@@ -189,6 +251,12 @@ SNMP_ERROR_STATUS Gauge32Callback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int Gauge32Callback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+
+    return encode_ber_integer(buf, max_len, GAUGE32, *this->value);
+}
+
 std::shared_ptr<BER_CONTAINER> Counter64Callback::buildTypeWithValue(){
     ASSERT_VALID_VALUE(this->value);
 
@@ -205,6 +273,12 @@ SNMP_ERROR_STATUS Counter64Callback::setTypeWithValue(BER_CONTAINER* rawValue){
     return NO_ERROR;
 }
 
+int Counter64Callback::serialiseValue(uint8_t* buf, size_t max_len){
+    ASSERT_VALID_ENCODE_VALUE(this->value);
+
+    return encode_ber_counter64(buf, max_len, *this->value);
+}
+
 bool SortableOIDType::sort_oids(SortableOIDType* oid1, SortableOIDType* oid2){ // returns true if oid1 EARLIER than oid2
     const auto& map1 = oid1->sortingMap;
     const auto& map2 = oid2->sortingMap;
@@ -0,0 +1,119 @@
+#ifndef AgentStats_h
+#define AgentStats_h
+
+#include "include/ValueCallbacks.h"
+
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
+    #include "tests/required/millis.h"
+#endif
+
+#include <stdint.h>
+
+enum SNMP_LATENCY_PHASE {
+    SNMP_LATENCY_DECODE = 0,    // parsing the request
+    SNMP_LATENCY_PERMISSION,    // checking its community
+    SNMP_LATENCY_DISPATCH,      // running the handlers into the response, or all of a GET that's answered in place
+    SNMP_LATENCY_ENCODE,        // finishing off the response
+    SNMP_LATENCY_SEND,          // handing the response to the UDP stack
+    SNMP_LATENCY_TOTAL,         // from reading the request off the socket to having sent the response
+    SNMP_LATENCY_PHASE_COUNT
+};
+
+#define SNMP_LATENCY_BUCKETS 14
+
+// Durations in µs, counted into buckets going up 1, 2, 5, 10, 20, 50 ... 5000, 10000µs, with the last one for anything longer.
+// Fixed buckets so recording is a few compares and an increment, percentiles are read back as the top of the bucket they land in
+struct SNMPLatencyHistogram {
+    uint32_t buckets[SNMP_LATENCY_BUCKETS] = {0};
+    uint32_t count = 0;
+    uint32_t max = 0;
+
+    void record(uint32_t micros);
+    uint32_t percentile(unsigned int percent) const;
+    // Upper bound of the bucket in µs
+    static uint32_t bucketLimit(int bucket);
+};
+
+// The snmp group counters from RFC 1213/3418, numbered by their arc under 1.3.6.1.2.1.11.
+// 7 and 23 were never assigned and 30 is snmpEnableAuthenTraps, which isn't a counter
+enum SNMP_MIB_COUNTER {
+    SNMP_IN_PKTS = 1,
+    SNMP_OUT_PKTS = 2,
+    SNMP_IN_BAD_VERSIONS = 3,
+    SNMP_IN_BAD_COMMUNITY_NAMES = 4,
+    SNMP_IN_BAD_COMMUNITY_USES = 5,
+    SNMP_IN_ASN_PARSE_ERRS = 6,
+    SNMP_IN_TOO_BIGS = 8,
+    SNMP_IN_NO_SUCH_NAMES = 9,
+    SNMP_IN_BAD_VALUES = 10,
+    SNMP_IN_READ_ONLYS = 11,
+    SNMP_IN_GEN_ERRS = 12,
+    SNMP_IN_TOTAL_REQ_VARS = 13,
+    SNMP_IN_TOTAL_SET_VARS = 14,
+    SNMP_IN_GET_REQUESTS = 15,
+    SNMP_IN_GET_NEXTS = 16,
+    SNMP_IN_SET_REQUESTS = 17,
+    SNMP_IN_GET_RESPONSES = 18,
+    SNMP_IN_TRAPS = 19,
+    SNMP_OUT_TOO_BIGS = 20,
+    SNMP_OUT_NO_SUCH_NAMES = 21,
+    SNMP_OUT_BAD_VALUES = 22,
+    SNMP_OUT_GEN_ERRS = 24,
+    SNMP_OUT_GET_REQUESTS = 25,
+    SNMP_OUT_GET_NEXTS = 26,
+    SNMP_OUT_SET_REQUESTS = 27,
+    SNMP_OUT_GET_RESPONSES = 28,
+    SNMP_OUT_TRAPS = 29,
+    SNMP_SILENT_DROPS = 31,
+    SNMP_PROXY_DROPS = 32,
+    SNMP_MIB_COUNTER_COUNT
+};
+
+struct SNMPAgentStats {
+    // Indexed by SNMP_MIB_COUNTER, always counted as it's just an increment.
+    // Like everything else here these belong to the agent's own loop, requests handled by a worker pool aren't counted
+    uint32_t counters[SNMP_MIB_COUNTER_COUNT] = {0};
+
+    void count(SNMP_MIB_COUNTER counter, uint32_t amount = 1){
+        counters[counter] += amount;
+    }
+    // Counts the error, if any, of a GetResponse going out (outgoing = true) or coming in
+    void countErrorStatus(int errorStatus, bool outgoing);
+
+    // Reading the clock isn't free, so it's only done once something's going to look at the results
+    bool timeLatency = false;
+    SNMPLatencyHistogram latency[SNMP_LATENCY_PHASE_COUNT];
+
+    // Records the time since start against phase, and starts the next phase from now
+    void lap(SNMP_LATENCY_PHASE phase, unsigned long& start){
+        if(!timeLatency) return;
+        unsigned long now = micros();
+        latency[phase].record(now - start);
+        start = now;
+    }
+};
+
+// Serves a percentile of a latency histogram, in µs
+class LatencyPercentileCallback: public ValueCallback {
+  public:
+    LatencyPercentileCallback(SortableOIDType* oid, const SNMPLatencyHistogram* histogram, unsigned int percent):
+        ValueCallback(oid, GAUGE32), histogram(histogram), percent(percent) {};
+
+  protected:
+    const SNMPLatencyHistogram* const histogram;
+    const unsigned int percent;
+
+    std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override {
+        return std::make_shared<Gauge>(histogram->percentile(percent));
+    }
+
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        return encode_ber_integer(buf, max_len, GAUGE32, histogram->percentile(percent));
+    }
+
+    SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER*) override {
+        return NO_ACCESS;
+    }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef AllocStats_h
+#define AllocStats_h
+
+#include "include/BER.h"
+
+#include <stddef.h>
+
+// Heap use of the request path, split by what was being done at the time and by the type of the request.
+// Only exists in host builds (COMPILING_TESTS), and nothing is actually counted unless SNMP_ALLOC_STATS is defined too,
+// which builds the malloc hooks in AllocStats.cpp. Counts are kept per thread, so each worker pool thread has its own.
+enum SNMP_ALLOC_PHASE {
+    SNMP_ALLOC_OUTSIDE = 0, // not in a request
+    SNMP_ALLOC_DECODE,      // parsing the request
+    SNMP_ALLOC_LOOKUP,      // finding handlers
+    SNMP_ALLOC_BUILD,       // getting values from handlers into the response
+    SNMP_ALLOC_ENCODE,      // writing the rest of the response around them
+    SNMP_ALLOC_PHASE_COUNT
+};
+
+#define SNMP_ALLOC_PDU_TYPES (ASN_PDU_TYPE_MAX_VALUE - ASN_PDU_TYPE_MIN_VALUE + 1)
+
+#ifdef COMPILING_TESTS
+
+struct SNMPAllocCount {
+    unsigned long allocations;
+    unsigned long bytes;
+};
+
+struct SNMPAllocStats {
+    SNMPAllocCount phases[SNMP_ALLOC_PHASE_COUNT];
+    // By PDU type, less ASN_PDU_TYPE_MIN_VALUE
+    SNMPAllocCount pduTypes[SNMP_ALLOC_PDU_TYPES];
+    unsigned long requests[SNMP_ALLOC_PDU_TYPES];
+};
+
+// The calling thread's counts
+SNMPAllocStats& snmp_alloc_stats();
+void snmp_alloc_stats_reset();
+// What the hooks call for every allocation
+void snmp_alloc_record(size_t bytes);
+
+// Everything allocated until the end of the scope counts against phase
+class SNMPAllocPhase {
+  public:
+    explicit SNMPAllocPhase(SNMP_ALLOC_PHASE phase);
+    ~SNMPAllocPhase();
+
+  private:
+    SNMP_ALLOC_PHASE previous;
+};
+
+// Everything allocated until the end of the scope counts against the request's PDU type, once it's known
+class SNMPAllocRequest {
+  public:
+    SNMPAllocRequest();
+    ~SNMPAllocRequest();
+
+    void setPDUType(ASN_TYPE type){ pduType = type; }
+
+  private:
+    SNMPAllocCount start;
+    ASN_TYPE pduType = NULLTYPE;
+};
+
+// Each one lasts to the end of its scope, so several in a row just move from one phase to the next
+#define SNMP_ALLOC_CONCAT_(a, b) a##b
+#define SNMP_ALLOC_CONCAT(a, b) SNMP_ALLOC_CONCAT_(a, b)
+#define SNMP_ALLOC_PHASE_SCOPE(phase) SNMPAllocPhase SNMP_ALLOC_CONCAT(_allocPhase, __LINE__)(phase)
+#define SNMP_ALLOC_REQUEST_SCOPE(name) SNMPAllocRequest name
+#define SNMP_ALLOC_REQUEST_TYPE(name, type) name.setPDUType(type)
+
+#else
+
+#define SNMP_ALLOC_PHASE_SCOPE(phase)
+#define SNMP_ALLOC_REQUEST_SCOPE(name)
+#define SNMP_ALLOC_REQUEST_TYPE(name, type)
+
+#endif
+#endif
@@ -11,7 +11,7 @@
 #include <stdint.h>
 #include <string>
 
-#ifdef COMPILING_TESTS
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
     #include "tests/required/IPAddress.h"
     #include "tests/required/UDP.h"
 #else
@@ -73,6 +73,8 @@ typedef int SNMP_BUFFER_ENCODE_ERROR;
 #define SNMP_BUFFER_ERROR_TYPE_MISMATCH (-5 + SNMP_BUFFER_PARSE_ERROR_OFFSET)
 #define SNMP_BUFFER_ERROR_OCTET_TOO_BIG (-6 + SNMP_BUFFER_PARSE_ERROR_OFFSET)
 #define SNMP_BUFFER_ERROR_INVALID_OID (-7 + SNMP_BUFFER_PARSE_ERROR_OFFSET)
+#define SNMP_BUFFER_ERROR_INVALID_LENGTH (-8 + SNMP_BUFFER_PARSE_ERROR_OFFSET)
+#define SNMP_BUFFER_ERROR_TOO_DEEP (-9 + SNMP_BUFFER_PARSE_ERROR_OFFSET)
 
 #define SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED (-1 + SNMP_BUFFER_ENCODE_ERROR_OFFSET)
 #define SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM (-2 + SNMP_BUFFER_ENCODE_ERROR_OFFSET)
@@ -81,6 +83,23 @@ typedef int SNMP_BUFFER_ENCODE_ERROR;
 #define CHECK_DECODE_ERR(i) if((i) < 0) return i
 #define CHECK_ENCODE_ERR(i) if((i) < 0) return i
 
+// Raw TLV encoders, shared by the container classes below and anything writing straight into a packet buffer
+// (eg SNMPResponseWriter), so both paths always produce identical bytes. All return bytes used, or an encode error.
+size_t encode_ber_length_integer_count(size_t integer);
+int encode_ber_header(uint8_t* buf, size_t max_len, ASN_TYPE type, size_t length);
+int encode_ber_integer(uint8_t* buf, size_t max_len, ASN_TYPE type, uint32_t value);
+int encode_ber_counter64(uint8_t* buf, size_t max_len, uint64_t value);
+int encode_ber_octets(uint8_t* buf, size_t max_len, ASN_TYPE type, const uint8_t* data, size_t length);
+
+// Total size of a TLV once encoded, for a value of length bytes
+inline size_t ber_tlv_length(size_t length){
+    return 1 + encode_ber_length_integer_count(length) + length;
+}
+
+// Reads a TLV header without building a container, checking the value fits within max_len. Returns the header length or a parse error.
+// This is the only bounds check the decoders make: once a header's passed it, the whole value is known to be in the buffer and gets read without any more
+int decode_ber_header(const uint8_t* buf, size_t max_len, ASN_TYPE* type, size_t* length);
+
 // primitive types inherits straight off the container, complex come off complexType
 // all primitives have to serialiseInto themselves (type, length, data), to be put straight into the packet.
 // for deserialising, from the parent container we check the type, then create anobject of that type and calls deSerialise, passing in the data, which pulls it out and saves, and if complex, first split up it schildren into seperate BERs, then creates and passes them creates a child with it's data using the same process.
@@ -103,6 +122,8 @@ class BER_CONTAINER {
     virtual int fromBuffer(const uint8_t *buf, size_t max_len);
 
     friend class ComplexType;
+    friend class ValueCallback;
+    friend class SNMPResponseWriter;
 };
 
 class NetworkAddress: public BER_CONTAINER {
@@ -181,6 +202,15 @@ protected:
 };
 
 
+// Long enough for most OIDs, anything longer is cut short with "..."
+#define SNMP_OID_STRING_LENGTH 128
+
+// An OID formatted onto the stack, only lives as long as the expression it's made in unless it's kept
+struct OIDString {
+    char value[SNMP_OID_STRING_LENGTH];
+    const char* c_str() const { return value; }
+};
+
 class OIDType: public BER_CONTAINER {
   public:
     explicit OIDType(const std::string& value): BER_CONTAINER(OID), _value(value) {
@@ -193,8 +223,10 @@ class OIDType: public BER_CONTAINER {
         return std::shared_ptr<OIDType>(new OIDType(this->_value, this->data, this->valid));
     };
 
-    // This is for display and finding purposes, only builds the string from data on request
+    // This is for display and finding purposes, only builds the string from data on request and keeps it
     const std::string& string();
+    // Builds the string without keeping it or allocating, for logging: SNMP_LOGD("%s", oid->format().c_str())
+    OIDString format() const;
     bool valid = false;
 
     bool equals(const std::shared_ptr<OIDType> oid) const {
@@ -205,6 +237,10 @@ class OIDType: public BER_CONTAINER {
         return this->data == oid->data;
     }
 
+    bool equals(const uint8_t* encoded, size_t length) const {
+        return this->data.size() == length && memcmp(this->data.data(), encoded, length) == 0;
+    }
+
     bool isSubTreeOf(const OIDType* const oid){
         // If the oid being searched for is smaller than us and is wholly contained in us, true
         // compare from the back so it's quicker
@@ -0,0 +1,88 @@
+#ifndef HandlerRegistry_h
+#define HandlerRegistry_h
+
+#include "ValueCallbacks.h"
+
+#include <atomic>
+#include <deque>
+
+// Whether handlers can be read from more than one thread or core at once (a host's worker pool, or both of an ESP32's cores).
+// If so every change is published as a fresh copy of the list, otherwise the one list is just changed in place.
+// Define SNMP_SINGLE_THREADED to keep a single list on a board that would otherwise be treated as threaded
+#if !defined(SNMP_THREADED) && !defined(SNMP_SINGLE_THREADED) && (defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX) || defined(ESP32))
+    #define SNMP_THREADED
+#endif
+
+#ifdef SNMP_THREADED
+    #define SNMP_REGISTRY_THREAD_LOCAL thread_local
+#else
+    #define SNMP_REGISTRY_THREAD_LOCAL
+#endif
+
+// The agent's list of handlers, safe to read from several threads (or cores) while it's being changed.
+// Readers take a Reader, which never locks and never waits, and sees one published snapshot of the list for as long as it's held.
+// Changes are made to a copy of that snapshot and published as the new one. The old one is freed once every reader that could still see it
+// has finished, which is also what makes it safe to delete a handler once remove() returns. Only the published list is kept between
+// changes, plus whatever's been added since.
+//
+// Adding a handler doesn't publish straight away, so adding thousands isn't quadratic, they become visible
+// at the next sort(), remove() or publish(). Those three would wait on themselves if called from inside a handler
+// (or anywhere else a Reader on this registry is held by the same thread), so they refuse, returning false, instead.
+class SNMPHandlerRegistry {
+  public:
+    SNMPHandlerRegistry();
+    ~SNMPHandlerRegistry();
+
+    // Copies take the other registry's handlers (including any not yet published) as their first snapshot
+    SNMPHandlerRegistry(const SNMPHandlerRegistry& other);
+    SNMPHandlerRegistry& operator=(const SNMPHandlerRegistry& other);
+
+    void add(ValueCallback* callback);
+    // Doesn't delete the callback, but once this returns nothing can still be reading it
+    bool remove(ValueCallback* callback);
+    bool sort();
+
+    // Publishes anything added since the last snapshot, returns false if there was nothing to publish
+    bool publish();
+
+    class Reader {
+      public:
+        explicit Reader(SNMPHandlerRegistry& registry);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const std::deque<ValueCallback*>& callbacks() const { return *snapshot; }
+
+      private:
+        SNMPHandlerRegistry& registry;
+        unsigned int epoch;
+        const std::deque<ValueCallback*>* snapshot;
+        // The Reader this thread was already holding when this one was taken, so a writer can tell it's being called from inside one
+        Reader* outer;
+        static SNMP_REGISTRY_THREAD_LOCAL Reader* innermost;
+
+        friend class SNMPHandlerRegistry;
+    };
+
+  private:
+    // Added since the last publish
+    std::deque<ValueCallback*> pending;
+
+    std::atomic<std::deque<ValueCallback*>*> current;
+    // Readers count themselves against the parity of the epoch they started in, a writer moves the epoch on
+    // and waits for the old parity to empty before freeing a snapshot
+    std::atomic<unsigned int> epoch;
+    std::atomic<int> readers[2];
+    mutable std::atomic_flag writing = ATOMIC_FLAG_INIT;
+
+    void lockWriter() const;
+    void unlockWriter() const;
+    bool readingOnThisThread() const;
+    // With the writer locked: the list to make a change to, with anything pending added, and then publishing it
+    std::deque<ValueCallback*>* beginChange();
+    void commitChange(std::deque<ValueCallback*>* changed);
+};
+
+#endif
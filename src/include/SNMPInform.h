@@ -5,13 +5,22 @@
 #include "include/BER.h"
 #include "SNMPTrap.h"
 
-#ifdef COMPILING_TESTS
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
     #include "tests/required/IPAddress.h"
 #endif
 
 #include <list>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <vector>
 #include <functional>
 
+// How many finished items are kept to reuse, any more are freed
+#ifndef SNMP_INFORM_MAX_FREE_ITEMS
+    #define SNMP_INFORM_MAX_FREE_ITEMS 8
+#endif
+
 struct InformItem {
     snmp_request_id_t requestID;
     int retries;
@@ -21,10 +30,88 @@ struct InformItem {
     unsigned long lastSent;
     SNMPTrap* trap;
     bool missed;
+    unsigned long dueAt;    // when it's next resent if there's no response, lastSent + delay_ms + 1
+    bool cancelled;         // replaced or its trap was deleted, freed once it reaches the top of the queue
+    std::vector<uint8_t> encoded; // exactly what was first sent, retries send this again rather than rebuilding the trap
+};
+
+// Keeps up to SNMP_INFORM_MAX_FREE_ITEMS freed blocks of one size to hand out again, so the nodes behind InformQueue's
+// indexes aren't allocated afresh for every Inform. The size is whatever's first asked for, anything else passes through
+struct InformNodePool {
+    InformNodePool(){}
+    ~InformNodePool();
+
+    InformNodePool(const InformNodePool&) = delete;
+    InformNodePool& operator=(const InformNodePool&) = delete;
+
+    void* allocate(size_t bytes);
+    void deallocate(void* ptr, size_t bytes);
+
+    size_t blockSize = 0;
+    size_t freeCount = 0;
+    void* freeBlocks = nullptr; // each one holds a pointer to the next
+};
+
+template<typename T>
+struct InformNodeAllocator {
+    typedef T value_type;
+
+    explicit InformNodeAllocator(InformNodePool* pool): pool(pool){}
+    template<typename U>
+    InformNodeAllocator(const InformNodeAllocator<U>& other): pool(other.pool){}
+
+    // Only single objects are the index's nodes, its bucket arrays go straight to the heap
+    T* allocate(size_t n){
+        return static_cast<T*>(n == 1 ? pool->allocate(sizeof(T)) : ::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n){
+        if(n == 1) pool->deallocate(ptr, sizeof(T));
+        else ::operator delete(ptr);
+    }
+
+    InformNodePool* pool;
+};
+
+template<typename T, typename U>
+inline bool operator==(const InformNodeAllocator<T>& a, const InformNodeAllocator<U>& b){ return a.pool == b.pool; }
+template<typename T, typename U>
+inline bool operator!=(const InformNodeAllocator<T>& a, const InformNodeAllocator<U>& b){ return a.pool != b.pool; }
+
+// Outstanding Informs, as a min-heap on dueAt so handling the queue only ever looks at the ones that are due.
+// Acknowledged or cancelled items stay in the heap, marked, until they reach the top.
+// Items still waiting on a response are also indexed by requestID and by trap, so acknowledging or replacing them doesn't
+// mean searching. Up to SNMP_INFORM_MAX_FREE_ITEMS finished items, with their encode buffers, and as many index nodes are kept
+// for reuse rather than freed, so once warm queueing and acknowledging an Inform doesn't allocate.
+struct InformQueue {
+    typedef std::pair<const snmp_request_id_t, struct InformItem*> RequestIDEntry;
+    typedef std::pair<SNMPTrap* const, struct InformItem*> TrapEntry;
+
+    InformQueue();
+    ~InformQueue();
+
+    InformQueue(const InformQueue&) = delete;
+    InformQueue& operator=(const InformQueue&) = delete;
+    InformQueue(InformQueue&&) = default;
+
+    // Ahead of the indexes so they're freed after them, the indexes give their nodes back to these as they go
+    std::unique_ptr<InformNodePool> requestIDNodes;
+    std::unique_ptr<InformNodePool> trapNodes;
+
+    std::vector<struct InformItem*> heap;
+    std::unordered_map<snmp_request_id_t, struct InformItem*, std::hash<snmp_request_id_t>, std::equal_to<snmp_request_id_t>, InformNodeAllocator<RequestIDEntry>> byRequestID;
+    std::unordered_multimap<SNMPTrap*, struct InformItem*, std::hash<SNMPTrap*>, std::equal_to<SNMPTrap*>, InformNodeAllocator<TrapEntry>> byTrap;
+    std::vector<struct InformItem*> freeItems;
+
+    // Informs still waiting on a response
+    size_t size() const { return byRequestID.size(); }
 };
 
-snmp_request_id_t queue_and_send_trap(std::list<struct InformItem *> &informList, SNMPTrap* trap, const IPAddress& ip, bool replaceQueuedRequests, int retries, int delay_ms);
-void inform_callback(std::list<struct InformItem *> &informList, snmp_request_id_t requestID, bool responseReceiveSuccess);
-void handle_inform_queue(std::list<struct InformItem*> &informList);
-void mark_trap_deleted(std::list<struct InformItem*> &informList, SNMPTrap* trap);
+snmp_request_id_t queue_and_send_trap(InformQueue &informQueue, SNMPTrap* trap, const IPAddress& ip, bool replaceQueuedRequests, int retries, int delay_ms);
+// Encodes the trap once and sends it to every receiver, each Inform only differing by its requestID. Returns how many were sent
+int queue_and_send_trap_to_all(InformQueue &informQueue, SNMPTrap* trap, const std::vector<IPAddress>& ips, bool replaceQueuedRequests, int retries, int delay_ms);
+void inform_callback(InformQueue &informQueue, snmp_request_id_t requestID, bool responseReceiveSuccess);
+void handle_inform_queue(InformQueue &informQueue);
+void mark_trap_deleted(InformQueue &informQueue, SNMPTrap* trap);
+// How long until handle_inform_queue() would next have something to do, in ms, or -1 if nothing's waiting
+long next_inform_timeout(const InformQueue &informQueue);
 #endif
\ No newline at end of file
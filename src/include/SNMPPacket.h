@@ -23,6 +23,8 @@ typedef int SNMP_PACKET_PARSE_ERROR;
 
 #define SNMP_PARSE_ERROR_MAGIC_BYTE -2 + SNMP_PACKET_PARSE_ERROR_OFFSET
 #define SNMP_PARSE_ERROR_GENERIC -1 + SNMP_PACKET_PARSE_ERROR_OFFSET
+// Where in the packet the parse gave up
+#define SNMP_PARSE_ERROR_AT_STATE(STATE) ((int)STATE * -1) - 10 + SNMP_PACKET_PARSE_ERROR_OFFSET
 
 
 union ErrorStatus {
@@ -5,16 +5,24 @@
 
 #include "include/SNMPPacket.h"
 #include "include/SNMPResponse.h"
+#include "include/SNMPResponseWriter.h"
 #include "include/ValueCallbacks.h"
+#include "include/AgentStats.h"
 
 #include <deque>
 
 typedef void (*informCB)(void* ctx, snmp_request_id_t, bool);
 
-bool handleGetRequestPDU(std::deque<ValueCallback*> &callbacks, std::deque<VarBind>& varbindList, std::deque<VarBind>& outResponseList, SNMP_VERSION version, bool isGetNextRequest);
-bool handleSetRequestPDU(std::deque<ValueCallback*> &callbacks, std::deque<VarBind>& varbindList, std::deque<VarBind>& outResponseList, SNMP_VERSION version);
-bool handleGetBulkRequestPDU(std::deque<ValueCallback*> &callbacks, std::deque<VarBind>& varbindList, std::deque<VarBind>& outResponseList, unsigned int nonRepeaters, unsigned int maxRepititions);
+bool handleGetRequestPDU(const std::deque<ValueCallback*>&callbacks, std::deque<VarBind>& varbindList, SNMPResponseWriter& response, SNMP_VERSION version, bool isGetNextRequest);
+bool handleSetRequestPDU(const std::deque<ValueCallback*>&callbacks, std::deque<VarBind>& varbindList, SNMPResponseWriter& response, SNMP_VERSION version);
+bool handleGetBulkRequestPDU(const std::deque<ValueCallback*>&callbacks, std::deque<VarBind>& varbindList, SNMPResponseWriter& response, unsigned int nonRepeaters, unsigned int maxRepititions);
 
-SNMP_ERROR_RESPONSE handlePacket(uint8_t* buffer, int packetLength, int* responseLength, int max_packet_size, std::deque<ValueCallback*> &callbacks, const std::string &_community, const std::string &_readOnlyCommunity, informCB = nullptr, void* ctx = nullptr);
+// Answers a plain GetRequest by rewriting the request buffer in place. Returns SNMP_NO_PACKET without touching the buffer if the
+// packet isn't something it can handle, in which case it should go through handlePacket. If the values don't fit it answers with a tooBig
+// and returns SNMP_ERROR_PACKET_SENT
+SNMP_ERROR_RESPONSE handleGetRequestInPlace(uint8_t* buffer, int packetLength, int* responseLength, int max_packet_size, const std::deque<ValueCallback*>&callbacks, const std::string &_community, const std::string &_readOnlyCommunity, SNMPAgentStats* stats = nullptr);
+
+// stats, if given, gets how long each part of handling the request took
+SNMP_ERROR_RESPONSE handlePacket(uint8_t* buffer, int packetLength, int* responseLength, int max_packet_size, const std::deque<ValueCallback*>&callbacks, const std::string &_community, const std::string &_readOnlyCommunity, informCB = nullptr, void* ctx = nullptr, SNMPAgentStats* stats = nullptr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef SNMPResponseWriter_h
+#define SNMPResponseWriter_h
+
+#include "BER.h"
+#include "defs.h"
+#include "SNMPPacket.h"
+#include "ValueCallbacks.h"
+
+#include <string>
+
+// type + 3 bytes of length, enough for anything that can fit in a packet
+#define SNMP_MAX_CONTAINER_HEADER_LENGTH 4
+// Integers are always written out as 4 bytes
+#define SNMP_INTEGER_TLV_LENGTH 6
+
+// Encodes a GetResponse straight into a packet buffer, varbind by varbind, without building any intermediate containers.
+// The header (version, community, PDU, requestID, errors) is only written in finish(), once the varbind lengths are known,
+// so space for the largest possible header is reserved at the front of the buffer and the varbinds are shifted back into place once.
+class SNMPResponseWriter {
+  public:
+    SNMPResponseWriter(uint8_t* buf, size_t max_len): buf(buf), max_len(max_len){};
+
+    // Takes version, community and requestID from the request (which has to outlive the writer), returns false if the buffer can't even fit the header
+    bool begin(const SNMPPacket& request);
+
+    // Each of these return SNMP_ERROR_OK once written, SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED when the buffer is full (and marks
+    // the writer as overflowed), or SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM if the callback couldn't give a value, in which case nothing is written
+    int addVarBind(OIDType* oid, ValueCallback* callback);
+    int addNullVarBind(OIDType* oid, ASN_TYPE nullType = NULLTYPE);
+    int addErrorVarBind(OIDType* oid, SNMP_ERROR_STATUS error);
+
+    void setGlobalError(SNMP_ERROR_STATUS error, int index, bool overwrite);
+
+    // Writes out the header and moves the varbinds in behind it, returns the total length of the packet or an encode error.
+    // If the varbinds overflowed the buffer they're all dropped and it's a tooBig instead, unless truncate is set
+    int finish();
+
+    size_t varbindCount = 0;
+    bool overflowed = false;
+    // GetBulk answers with however many varbinds fit rather than tooBig (RFC 3416 4.2.3)
+    bool truncate = false;
+
+    SNMP_ERROR_STATUS errorStatus = NO_ERROR;
+    int errorIndex = 0;
+
+  private:
+    uint8_t* const buf;
+    const size_t max_len;
+
+    uint8_t* varbindStart = nullptr;
+    uint8_t* ptr = nullptr;
+
+    SNMP_VERSION snmpVersion = SNMP_VERSION_1;
+    const std::string* communityString = nullptr;
+    snmp_request_id_t requestID = 0;
+    // Echoed back in a v1 tooBig
+    const std::deque<VarBind>* requestVarBinds = nullptr;
+
+    int writeOID(OIDType* oid, uint8_t* dest);
+    int commitVarBind(size_t bodyLength);
+    int addRequestVarBind(const VarBind& varbind);
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SNMPTRAPQUEUE_h
+#define SNMPTRAPQUEUE_h
+
+#include "include/defs.h"
+#include "SNMPTrap.h"
+
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
+    #include "tests/required/IPAddress.h"
+#endif
+
+#include <deque>
+#include <vector>
+
+enum SNMP_TRAP_PRIORITY {
+    SNMP_TRAP_PRIORITY_LOW = 0,
+    SNMP_TRAP_PRIORITY_NORMAL,
+    SNMP_TRAP_PRIORITY_HIGH,
+    SNMP_TRAP_PRIORITY_COUNT
+};
+
+struct TrapQueueItem {
+    SNMPTrap* trap;
+    std::vector<IPAddress> ips;     // receivers it's still to be sent to
+    bool replaceQueuedRequests;
+    int retries;
+    int delay_ms;
+};
+
+struct SNMPTrapQueueStats {
+    unsigned long queued = 0;       // traps added to the queue
+    unsigned long coalesced = 0;    // sends folded into the same trap already waiting
+    unsigned long dropped = 0;      // traps thrown away because the queue was full
+    unsigned long sent = 0;         // datagrams sent from the queue
+};
+
+// Traps waiting to be sent, highest priority first, oldest first within a priority.
+// Queuing a trap that's already waiting only adds any new receivers to it, its values are read when it actually goes out.
+// Once full, a new trap pushes out the oldest one of a lower priority, or is dropped if there isn't one.
+// Sending is paced by a token bucket, a token per datagram, refilled at ratePerSecond and holding up to burst.
+struct TrapQueue {
+    std::deque<TrapQueueItem> items[SNMP_TRAP_PRIORITY_COUNT];
+    size_t maxItems = 32;
+
+    unsigned int ratePerSecond = 0; // 0 for no limit
+    unsigned int burst = 1;
+    unsigned long tokens = 0;       // in thousandths, so refilling doesn't need floats
+    unsigned long lastRefill = 0;
+
+    SNMPTrapQueueStats stats;
+
+    size_t size() const;
+};
+
+// Returns false if the trap was dropped, or had no receivers (it would never get a token, and hold up everything behind it)
+bool trap_queue_push(TrapQueue &trapQueue, SNMPTrap* trap, const std::vector<IPAddress>& ips, SNMP_TRAP_PRIORITY priority,
+                     bool replaceQueuedRequests, int retries, int delay_ms);
+// The next trap to send, or nullptr if there's nothing waiting
+TrapQueueItem* trap_queue_front(TrapQueue &trapQueue);
+void trap_queue_pop(TrapQueue &trapQueue);
+void trap_queue_remove(TrapQueue &trapQueue, SNMPTrap* trap);
+
+void trap_queue_set_rate(TrapQueue &trapQueue, unsigned int ratePerSecond, unsigned int burst);
+// How many of `wanted` datagrams can go out right now, using up the tokens for them
+size_t trap_queue_take_tokens(TrapQueue &trapQueue, size_t wanted);
+// How long until the next queued trap can be sent, in ms, or -1 if there's nothing queued
+long trap_queue_timeout(const TrapQueue &trapQueue);
+#endif
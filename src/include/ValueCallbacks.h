@@ -26,13 +26,20 @@ class ValueCallback {
         setOccurred = false;
     }
 
-    static ValueCallback* findCallback(std::deque<ValueCallback*> &callbacks, const OIDType* const oid, bool walk, size_t startAt = 0, size_t *foundAt = nullptr);
+    static ValueCallback* findCallback(const std::deque<ValueCallback*>&callbacks, const OIDType* const oid, bool walk, size_t startAt = 0, size_t *foundAt = nullptr);
+    // Exact match against an OID still in its encoded form, so a lookup doesn't need an OIDType built for it
+    static ValueCallback* findCallback(const std::deque<ValueCallback*>&callbacks, const uint8_t* oid, size_t oidLength);
     static std::shared_ptr<BER_CONTAINER> getValueForCallback(ValueCallback* callback);
+    // Writes the value TLV straight into buf, returns bytes used or an encode error (SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM if there's no value)
+    static int serialiseValueForCallback(ValueCallback* callback, uint8_t* buf, size_t max_len);
     static SNMP_ERROR_STATUS setValueForCallback(ValueCallback* callback, const std::shared_ptr<BER_CONTAINER> &value);
 
 protected:
     virtual std::shared_ptr<BER_CONTAINER> buildTypeWithValue() = 0;
     virtual SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) = 0;
+
+    // Default builds the container and serialises it, callbacks that can encode their value directly override this to skip the allocation
+    virtual int serialiseValue(uint8_t* buf, size_t max_len);
 };
 
 bool compare_callbacks (const ValueCallback* first, const ValueCallback* second);
@@ -49,6 +56,7 @@ class IntegerCallback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 class StaticIntegerCallback: public ValueCallback {
@@ -62,6 +70,10 @@ class StaticIntegerCallback: public ValueCallback {
         return std::make_shared<IntegerType>(val);
     }
 
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        return encode_ber_integer(buf, max_len, INTEGER, val);
+    }
+
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER*) override {
         return NO_ACCESS;
     }
@@ -79,6 +91,10 @@ protected:
         return std::make_shared<IntegerType>(m_callback());
     }
 
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        return encode_ber_integer(buf, max_len, INTEGER, m_callback());
+    }
+
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER*) override {
         return NO_ACCESS;
     }
@@ -93,6 +109,7 @@ class TimestampCallback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 class DynamicTimestampCallback: public ValueCallback {
@@ -107,6 +124,10 @@ protected:
         return std::make_shared<TimestampType>(m_callback());
     }
 
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        return encode_ber_integer(buf, max_len, TIMESTAMP, m_callback());
+    }
+
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER*) override {
         return NO_ACCESS;
     }
@@ -123,6 +144,10 @@ protected:
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER*) override {
         return NO_ACCESS;
     };
+
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        return encode_ber_octets(buf, max_len, STRING, (const uint8_t*)value.data(), value.length());
+    }
 };
 
 class DynamicStringCallback: public ValueCallback {
@@ -138,6 +163,11 @@ protected:
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER*) override {
         return NO_ACCESS;
     };
+
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        const std::string value = m_callback();
+        return encode_ber_octets(buf, max_len, STRING, (const uint8_t*)value.data(), value.length());
+    }
 };
 
 class StringCallback: public ValueCallback {
@@ -150,6 +180,7 @@ class StringCallback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 class OpaqueCallback: public ValueCallback {
@@ -162,6 +193,7 @@ class OpaqueCallback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 class OIDCallback: public ValueCallback {
@@ -186,6 +218,7 @@ class Counter32Callback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 
@@ -198,6 +231,7 @@ class Gauge32Callback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 class DynamicGauge32Callback: public ValueCallback {
@@ -210,6 +244,10 @@ class DynamicGauge32Callback: public ValueCallback {
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override {
         return std::make_shared<Gauge>(m_callback());
     }
+
+    int serialiseValue(uint8_t* buf, size_t max_len) override {
+        return encode_ber_integer(buf, max_len, GAUGE32, m_callback());
+    }
     SNMP_ERROR_STATUS setTypeWithValue (BER_CONTAINER*) override{
         return NO_ACCESS;
     };
@@ -224,6 +262,7 @@ class Counter64Callback: public ValueCallback {
 
     std::shared_ptr<BER_CONTAINER> buildTypeWithValue() override;
     SNMP_ERROR_STATUS setTypeWithValue(BER_CONTAINER* value) override;
+    int serialiseValue(uint8_t* buf, size_t max_len) override;
 };
 
 #endif
@@ -47,6 +47,12 @@ extern const char* SNMP_TAG;
 #define MAX_SNMP_PACKET_LENGTH 1400
 #define OCTET_TYPE_MAX_LENGTH 500
 
+// How many constructed TLVs can be open at once while decoding, a request needs 4 (message, PDU, varbind list, varbind).
+// Anything nested deeper is refused, and the decoder's stack use is fixed by this rather than by what it's sent
+#ifndef SNMP_MAX_DECODE_DEPTH
+    #define SNMP_MAX_DECODE_DEPTH 8
+#endif
+
 #define SNMP_ERROR_OK 1
 
 #define SNMP_PACKET_PARSE_ERROR_OFFSET -20
@@ -105,7 +111,9 @@ typedef struct RFC1213SystemStruct {
     } RFC1213_list;
 
 // DEBUG
-#if defined(COMPILING_TESTS)
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
+    #include <stdio.h>
+
     #define _LOGD(...)          printf(__VA_ARGS__)
     #define _LOGI(...)          printf(__VA_ARGS__)
     #define _LOGW(...)          printf(__VA_ARGS__)
@@ -125,18 +133,41 @@ typedef struct RFC1213SystemStruct {
 #endif
 
 // ----
+// DEBUG picks what's compiled in at all, anything above it costs nothing, its arguments aren't even evaluated.
+// What is compiled in can be turned down at runtime with snmp_log_level(), and again the arguments are only
+// evaluated if the message is actually going to be printed, so a DEBUG build can run at full speed until it's needed
+#define SNMP_LOG_LEVEL_NONE     0
+#define SNMP_LOG_LEVEL_ERROR    1
+#define SNMP_LOG_LEVEL_WARN     2
+#define SNMP_LOG_LEVEL_INFO     3
+#define SNMP_LOG_LEVEL_DEBUG    4
+
 #if (DEBUG ==1)
-    #define SNMP_LOGD           _LOGD
-    #define SNMP_LOGI           _LOGI
-    #define SNMP_LOGW           _LOGW
-    #define SNMP_LOGE           _LOGE
+    #define SNMP_LOG_LEVEL      SNMP_LOG_LEVEL_DEBUG
 #elif (DEBUG ==2)
-    #define SNMP_LOGD(...)
-    #define SNMP_LOGI           _LOGI
-    #define SNMP_LOGW           _LOGW
-    #define SNMP_LOGE           _LOGE
+    #define SNMP_LOG_LEVEL      SNMP_LOG_LEVEL_INFO
+#else
+    #define SNMP_LOG_LEVEL      SNMP_LOG_LEVEL_NONE
+#endif
+
+// Starts at the compiled in level, can only usefully be lowered
+inline uint8_t& snmp_log_level(){
+    static uint8_t level = SNMP_LOG_LEVEL;
+    return level;
+}
+
+#define SNMP_LOG_AT(level, log, ...)    do { if(snmp_log_level() >= (level)) log(__VA_ARGS__); } while(0)
+
+#if SNMP_LOG_LEVEL >= SNMP_LOG_LEVEL_DEBUG
+    #define SNMP_LOGD(...)      SNMP_LOG_AT(SNMP_LOG_LEVEL_DEBUG, _LOGD, __VA_ARGS__)
 #else
     #define SNMP_LOGD(...)
+#endif
+#if SNMP_LOG_LEVEL >= SNMP_LOG_LEVEL_INFO
+    #define SNMP_LOGI(...)      SNMP_LOG_AT(SNMP_LOG_LEVEL_INFO, _LOGI, __VA_ARGS__)
+    #define SNMP_LOGW(...)      SNMP_LOG_AT(SNMP_LOG_LEVEL_WARN, _LOGW, __VA_ARGS__)
+    #define SNMP_LOGE(...)      SNMP_LOG_AT(SNMP_LOG_LEVEL_ERROR, _LOGE, __VA_ARGS__)
+#else
     #define SNMP_LOGI(...)
     #define SNMP_LOGW(...)
     #define SNMP_LOGE(...)
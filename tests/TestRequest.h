@@ -0,0 +1,21 @@
+#ifndef TestRequest_h
+#define TestRequest_h
+
+#include "include/SNMPPacket.h"
+
+#include <string>
+#include <vector>
+
+// Fills in a request's header and a NULL varbind for each of nullOIDs, anything else can be pushed onto varbindList after.
+// Shared by the tests, bench and fuzz seeds, which all need requests to feed the agent
+inline void SetupTestSNMPRequest(SNMPPacket& request, ASN_TYPE pduType, SNMP_VERSION version, const char* community, snmp_request_id_t requestID, const std::vector<std::string>& nullOIDs = {}){
+    request.setPDUType(pduType);
+    request.setCommunityString(community);
+    request.setRequestID(requestID);
+    request.setVersion(version);
+    for(const std::string& oid : nullOIDs){
+        request.varbindList.push_back(VarBind(std::make_shared<OIDType>(oid), std::make_shared<NullType>()));
+    }
+}
+
+#endif
@@ -0,0 +1,327 @@
+#include "SNMP_Agent.h"
+#include "include/AllocStats.h"
+#include "TestRequest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <new>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAVE_TSC 1
+#endif
+
+// Hands the same request to the agent every time it's polled, and throws away whatever it sends back
+class LoopbackUDP: public UDP {
+  public:
+    uint8_t request[MAX_SNMP_PACKET_LENGTH];
+    int requestLength = 0;
+    int lastResponseLength = 0;
+
+    int parsePacket() override { return requestLength; }
+    int read(uint8_t* buf, int len) override {
+        memcpy(buf, request, len);
+        return len;
+    }
+    void write(const uint8_t*, size_t len) override { lastResponseLength = len; }
+};
+
+// Every operator new in the process is counted, so each benchmark can say how many allocations an op costs
+static unsigned long allocations = 0;
+
+void* operator new(size_t size){
+    allocations++;
+    void* ptr = malloc(size ? size : 1);
+    if(!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+struct BenchResult {
+    double nsPerOp;
+    double ticksPerOp;
+    double allocsPerOp;
+};
+
+template<typename F>
+static BenchResult measure(unsigned long iterations, F fn){
+    // Warm up caches and branch predictors first
+    for(unsigned long i = 0; i < iterations / 10; i++) fn();
+
+    unsigned long startAllocations = allocations;
+    auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+    unsigned long long startTicks = __rdtsc();
+#endif
+    for(unsigned long i = 0; i < iterations; i++) fn();
+#ifdef HAVE_TSC
+    unsigned long long ticks = __rdtsc() - startTicks;
+#else
+    unsigned long long ticks = 0;
+#endif
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    BenchResult result = { elapsed / iterations, (double)ticks / iterations, (double)(allocations - startAllocations) / iterations };
+    return result;
+}
+
+static void print_result(const char* name, const BenchResult& result){
+    printf("%-48s %12.1f ns/op %12.1f ticks/op %8.1f allocs/op\n", name, result.nsPerOp, result.ticksPerOp, result.allocsPerOp);
+}
+
+template<typename F>
+static BenchResult run_bench(const char* name, unsigned long iterations, F fn){
+    BenchResult result = measure(iterations, fn);
+    print_result(name, result);
+    return result;
+}
+
+// Runs two variants turn about a few times and keeps the best of each, so drift over the run doesn't favour either
+template<typename F, typename G>
+static void run_comparison(const char* beforeName, const char* afterName, unsigned long iterations, F before, G after){
+    BenchResult best[2];
+    for(int round = 0; round < 5; round++){
+        BenchResult results[2] = { measure(iterations, before), measure(iterations, after) };
+        for(int i = 0; i < 2; i++){
+            if(round == 0 || results[i].nsPerOp < best[i].nsPerOp) best[i] = results[i];
+        }
+    }
+    print_result(beforeName, best[0]);
+    print_result(afterName, best[1]);
+    printf("%-48s %12.1f ns/op %12.1f ticks/op %7.1f%%\n", "saved per op",
+        best[0].nsPerOp - best[1].nsPerOp, best[0].ticksPerOp - best[1].ticksPerOp,
+        100.0 * (best[0].nsPerOp - best[1].nsPerOp) / best[0].nsPerOp);
+}
+
+static int build_request(uint8_t* buffer, ASN_TYPE pduType, const char* community, const char* oid, std::shared_ptr<BER_CONTAINER> value){
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, pduType, SNMP_VERSION_2C, community, 1234);
+    if(pduType == GetBulkRequestPDU){
+        request.errorStatus.nonRepeaters = 0;
+        request.errorIndex.maxRepititions = 10;
+    }
+    request.varbindList.push_back(VarBind(std::make_shared<OIDType>(oid), value));
+    return request.serialiseInto(buffer, MAX_SNMP_PACKET_LENGTH);
+}
+
+static int build_get_request(uint8_t* buffer, const char* oid){
+    return build_request(buffer, GetRequestPDU, "public", oid, std::make_shared<NullType>());
+}
+
+// Keeps the optimiser from throwing away work whose result isn't otherwise used
+template<typename T>
+static inline void keep(const T& value){
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// A response with 10 varbinds, what a typical walk of a small table sends back
+static void bench_codec(){
+    printf("\n== BER codec ==\n");
+    const unsigned long iterations = 200000;
+
+    SNMPPacket response;
+    SetupTestSNMPRequest(response, GetResponsePDU, SNMP_VERSION_2C, "public", 1234);
+    for(int i = 0; i < 10; i++){
+        char oid[32];
+        snprintf(oid, sizeof(oid), ".1.3.6.1.4.1.5.%d.0", 1000 + i);
+        response.varbindList.push_back(VarBind(std::make_shared<OIDType>(oid), std::make_shared<IntegerType>(i * 1000)));
+    }
+    uint8_t encoded[MAX_SNMP_PACKET_LENGTH];
+    int length = response.serialiseInto(encoded, MAX_SNMP_PACKET_LENGTH);
+
+    run_bench("ComplexType::fromBuffer, 10 varbinds", iterations, [&](){
+        ComplexType decoded(STRUCTURE);
+        keep(decoded.fromBuffer(encoded, length));
+    });
+
+    ComplexType decoded(STRUCTURE);
+    decoded.fromBuffer(encoded, length);
+    uint8_t out[MAX_SNMP_PACKET_LENGTH];
+    run_bench("ComplexType::serialise, 10 varbinds", iterations, [&](){
+        keep(decoded.serialise(out, MAX_SNMP_PACKET_LENGTH));
+    });
+
+    const std::string oid = ".1.3.6.1.4.1.52420.1.2.3.65535";
+    run_bench("OIDType::generateInternalData (OIDType(string))", iterations, [&](){
+        OIDType parsed(oid);
+        keep(parsed.valid);
+    });
+}
+
+// Where the allocations went, only counted when built with SNMP_ALLOC_STATS
+static void print_alloc_phases(ASN_TYPE pduType){
+#ifdef SNMP_ALLOC_STATS
+    const SNMPAllocStats& stats = snmp_alloc_stats();
+    unsigned long requests = stats.requests[pduType - ASN_PDU_TYPE_MIN_VALUE];
+    if(!requests) return;
+
+    static const char* names[SNMP_ALLOC_PHASE_COUNT] = { "outside", "decode", "lookup", "build", "encode" };
+    printf("    allocs/op by phase:");
+    for(int phase = SNMP_ALLOC_DECODE; phase < SNMP_ALLOC_PHASE_COUNT; phase++){
+        printf(" %s %.1f (%.0f B)", names[phase], (double)stats.phases[phase].allocations / requests,
+            (double)stats.phases[phase].bytes / requests);
+    }
+    printf("\n");
+#else
+    (void)pduType;
+#endif
+}
+
+// Never freed, same as an agent's handlers
+struct HandlerTable {
+    std::deque<ValueCallback*> callbacks;
+    std::vector<int> values;
+    std::string middle;
+
+    explicit HandlerTable(int count): values(count){
+        for(int i = 0; i < count; i++){
+            char oid[32];
+            snprintf(oid, sizeof(oid), ".1.3.6.1.4.1.5.%d", i + 1);
+            values[i] = i;
+            IntegerCallback* callback = new IntegerCallback(new SortableOIDType(oid), &values[i]);
+            callback->isSettable = true;
+            callbacks.push_back(callback);
+            if(i == count / 2) middle = oid;
+        }
+        // Handlers are usually added in whatever order the sketch happens to, not OID order
+        std::shuffle(callbacks.begin(), callbacks.end(), std::mt19937(42));
+        sort_handlers(callbacks);
+    }
+};
+
+static void bench_handlers(int count){
+    printf("\n== %d handlers ==\n", count);
+    // Keep the slow cases from taking forever while the fast ones still get enough runs to be stable
+    const unsigned long iterations = count >= 30000 ? 2000 : 50000;
+    char name[64];
+
+    HandlerTable table(count);
+    OIDType middle(table.middle);
+
+    std::deque<ValueCallback*> shuffled = table.callbacks;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(7));
+    snprintf(name, sizeof(name), "sort_handlers, %d", count);
+    run_bench(name, count >= 30000 ? 20 : 500, [&](){
+        std::deque<ValueCallback*> toSort = shuffled;
+        sort_handlers(toSort);
+        keep(toSort.front());
+    });
+
+    snprintf(name, sizeof(name), "findCallback(OIDType), %d", count);
+    run_bench(name, iterations, [&](){
+        keep(ValueCallback::findCallback(table.callbacks, &middle, false));
+    });
+
+    // The OID as it sits in a request, past its type and length
+    ComplexType wrapper(STRUCTURE);
+    wrapper.addValueToList(middle.cloneOID());
+    uint8_t encoded[MAX_SNMP_PACKET_LENGTH];
+    int encodedLength = wrapper.serialise(encoded, MAX_SNMP_PACKET_LENGTH);
+    ASN_TYPE type;
+    size_t length;
+    int outer = decode_ber_header(encoded, encodedLength, &type, &length);
+    int inner = decode_ber_header(encoded + outer, encodedLength - outer, &type, &length);
+    const uint8_t* encodedOID = encoded + outer + inner;
+    snprintf(name, sizeof(name), "findCallback(encoded), %d", count);
+    run_bench(name, iterations, [&](){
+        keep(ValueCallback::findCallback(table.callbacks, encodedOID, length));
+    });
+
+    struct {
+        const char* name;
+        ASN_TYPE pduType;
+        const char* community;
+        std::shared_ptr<BER_CONTAINER> value;
+    } requests[] = {
+        { "GET", GetRequestPDU, "public", std::make_shared<NullType>() },
+        { "GETNEXT", GetNextRequestPDU, "public", std::make_shared<NullType>() },
+        { "GETBULK x10", GetBulkRequestPDU, "public", std::make_shared<NullType>() },
+        { "SET", SetRequestPDU, "private", std::make_shared<IntegerType>(7) },
+    };
+
+    const std::string readWrite = "private";
+    const std::string readOnly = "public";
+    for(auto& request : requests){
+        uint8_t packet[MAX_SNMP_PACKET_LENGTH];
+        int packetLength = build_request(packet, request.pduType, request.community, table.middle.c_str(), request.value);
+
+        // The response is written over the request, so each run starts from a fresh copy
+        uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+        snprintf(name, sizeof(name), "handlePacket %s, %d", request.name, count);
+        snmp_alloc_stats_reset();
+        run_bench(name, iterations, [&](){
+            memcpy(buffer, packet, packetLength);
+            int responseLength = 0;
+            keep(handlePacket(buffer, packetLength, &responseLength, MAX_SNMP_PACKET_LENGTH, table.callbacks, readWrite, readOnly));
+        });
+        print_alloc_phases(request.pduType);
+    }
+}
+
+// What SNMPAgent::loop() does with a packet once it's been told one is waiting. clearBuffer puts back the two
+// full-buffer clears it used to do: one before reading, and one in handlePacket() once the request had been parsed.
+// That one has to come before handlePacket() here so the request survives it, so it only clears past the request.
+static void receive_packet(UDP& udp, uint8_t* buffer, const std::deque<ValueCallback*>& callbacks, bool clearBuffer){
+    static const std::string readWrite = "private";
+    static const std::string readOnly = "public";
+    int packetLength = udp.parsePacket();
+    if(clearBuffer) memset(buffer, 0, MAX_SNMP_PACKET_LENGTH);
+    udp.read(buffer, packetLength);
+    if(clearBuffer) memset(buffer + packetLength, 0, MAX_SNMP_PACKET_LENGTH - packetLength);
+    keep(buffer);
+
+    int responseLength = 0;
+    if(handlePacket(buffer, packetLength, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks, readWrite, readOnly) > 0){
+        udp.write(buffer, responseLength);
+    }
+}
+
+// A whole trip through SNMPAgent::loop(), receive buffer, parse, response and send, which is what a packet actually costs.
+// Alongside it the same receive path with and without the buffer clears, so the saving is measured in the same run
+static void bench_agent_loop(){
+    printf("\n== SNMPAgent::loop() ==\n");
+    const unsigned long iterations = 200000;
+
+    SNMPAgent agent("public", "private");
+    LoopbackUDP udp;
+    agent.setUDP(&udp);
+
+    int values[10] = {0};
+    for(int i = 0; i < 10; i++){
+        char oid[32];
+        snprintf(oid, sizeof(oid), ".1.3.6.1.4.1.5.%d", i);
+        agent.addIntegerHandler(oid, &values[i]);
+    }
+    agent.sortHandlers();
+    udp.requestLength = build_get_request(udp.request, ".1.3.6.1.4.1.5.5");
+
+    run_bench("SNMPAgent::loop() GET, 10 handlers", iterations, [&agent](){
+        agent.loop();
+    });
+
+    HandlerTable table(10);
+    LoopbackUDP tableUDP;
+    tableUDP.requestLength = build_get_request(tableUDP.request, table.middle.c_str());
+    static uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+
+    run_comparison("receive path GET, clearing the buffer (before)", "receive path GET, no clears (after)", iterations,
+        [&](){ receive_packet(tableUDP, buffer, table.callbacks, true); },
+        [&](){ receive_packet(tableUDP, buffer, table.callbacks, false); });
+}
+
+int main(){
+    bench_codec();
+    bench_handlers(10);
+    bench_handlers(1000);
+    bench_handlers(30000);
+    bench_agent_loop();
+    return 0;
+}
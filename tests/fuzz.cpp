@@ -0,0 +1,208 @@
+#include "include/SNMPParser.h"
+#include "include/ValueCallbacks.h"
+#include "TestRequest.h"
+
+// Fuzz target for the decode and request paths: every input is decoded as a bare BER structure, as an SNMPPacket, and
+// handed to handlePacket() against a small table of handlers as if it had come off the wire.
+// Built with clang and SNMP_FUZZ this is a libFuzzer target; otherwise main() below replays files through it, which
+// is how the seed corpus and any crashers get checked under the sanitizers without clang.
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static int integerValue = 42;
+static uint32_t counterValue = 7;
+static uint64_t counter64Value = 0x123456789aULL;
+static char stringStorage[32] = "test";
+static char* stringValue = stringStorage;
+static uint8_t opaqueValue[] = { 1, 2, 3, 4 };
+
+// Never freed (and kept reachable, so LeakSanitizer doesn't complain), the handlers live as long as the process like an agent's do
+static const std::deque<ValueCallback*>& callbacks(){
+    static std::deque<ValueCallback*>* table = nullptr;
+    if(!table){
+        table = new std::deque<ValueCallback*>();
+        table->push_back(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &integerValue));
+        table->push_back(new StringCallback(new SortableOIDType(".1.3.6.1.4.1.5.2"), &stringValue, sizeof(stringStorage) - 1));
+        table->push_back(new ReadOnlyStringCallback(new SortableOIDType(".1.3.6.1.4.1.5.3"), std::string(300, 'x')));
+        table->push_back(new Counter32Callback(new SortableOIDType(".1.3.6.1.4.1.5.4"), &counterValue));
+        table->push_back(new Counter64Callback(new SortableOIDType(".1.3.6.1.4.1.5.5"), &counter64Value));
+        table->push_back(new OpaqueCallback(new SortableOIDType(".1.3.6.1.4.1.5.6"), opaqueValue, sizeof(opaqueValue)));
+        table->push_back(new OIDCallback(new SortableOIDType(".1.3.6.1.4.1.5.7"), ".1.3.6.1.4.1.52420"));
+        table->push_back(new StaticIntegerCallback(new SortableOIDType(".1.3.6.1.4.1.52420.9999999"), 5));
+        for(ValueCallback* callback : *table) callback->isSettable = true;
+        sort_handlers(*table);
+    }
+    return *table;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+    // Nothing to decode, and data can be null (an empty file when replaying)
+    if(size == 0 || size > MAX_SNMP_PACKET_LENGTH) return 0;
+
+    // Each decoder gets its own copy sized exactly to the input, so reading a byte past the end is an ASan error
+    {
+        std::vector<uint8_t> exact(data, data + size);
+        ComplexType decoded(STRUCTURE);
+        decoded.fromBuffer(exact.data(), exact.size());
+    }
+    {
+        std::vector<uint8_t> exact(data, data + size);
+        SNMPPacket packet;
+        packet.parseFrom(exact.data(), exact.size());
+    }
+
+    // handlePacket writes the response back over the request, so it needs a whole packet's worth of room
+    std::vector<uint8_t> buffer(MAX_SNMP_PACKET_LENGTH);
+    memcpy(buffer.data(), data, size);
+    int responseLength = 0;
+    handlePacket(buffer.data(), size, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks(), "private", "public");
+
+    // Whatever we answered with has to decode again
+    if(responseLength > 0){
+        std::vector<uint8_t> response(buffer.begin(), buffer.begin() + responseLength);
+        SNMPPacket packet;
+        if(packet.parseFrom(response.data(), response.size()) != SNMP_ERROR_OK) __builtin_trap();
+    }
+    return 0;
+}
+
+#ifndef SNMP_FUZZ_LIBFUZZER
+
+static SNMPPacket* make_request(ASN_TYPE pduType, SNMP_VERSION version, const char* community, const std::vector<std::string>& nullOIDs = {}){
+    SNMPPacket* packet = new SNMPPacket();
+    SetupTestSNMPRequest(*packet, pduType, version, community, 0x1234, nullOIDs);
+    return packet;
+}
+
+// The same sorts of packets tests/tests.cpp builds, one per file
+static int write_seeds(const char* dir){
+    std::vector<std::pair<std::string, SNMPPacket*>> seeds;
+
+    SNMPPacket* packet = make_request(GetRequestPDU, SNMP_VERSION_1, "public");
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.1"), std::make_shared<IntegerType>(42)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.2"), std::make_shared<OctetType>("test 123")));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.52420.9999999"), std::make_shared<IntegerType>(0)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.3"), std::make_shared<IntegerType>(-42)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.4"), std::make_shared<IntegerType>(-420000)));
+    seeds.push_back({ "get-v1", packet });
+
+    std::vector<std::string> oids;
+    for(int i = 1; i <= 7; i++) oids.push_back(".1.3.6.1.4.1.5." + std::to_string(i));
+    packet = make_request(GetRequestPDU, SNMP_VERSION_2C, "public", oids);
+    seeds.push_back({ "get-v2c", packet });
+
+    packet = make_request(GetRequestPDU, SNMP_VERSION_2C, "wrong", {".1.3.6.1.4.1.5.1"});
+    seeds.push_back({ "get-bad-community", packet });
+
+    packet = make_request(GetNextRequestPDU, SNMP_VERSION_2C, "public", {".1.3.6.1.4.1.5", ".1.3.6.1.4.1.52420"});
+    seeds.push_back({ "getnext", packet });
+
+    packet = make_request(GetBulkRequestPDU, SNMP_VERSION_2C, "public", {".1.3.6.1.4.1.5.1", ".1.3.6.1.4.1.5"});
+    packet->errorStatus.nonRepeaters = 1;
+    packet->errorIndex.maxRepititions = 5;
+    seeds.push_back({ "getbulk", packet });
+
+    packet = make_request(SetRequestPDU, SNMP_VERSION_2C, "private");
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.1"), std::make_shared<IntegerType>(5)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.2"), std::make_shared<OctetType>("changed")));
+    seeds.push_back({ "set", packet });
+
+    packet = make_request(SetRequestPDU, SNMP_VERSION_1, "public");
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.1"), std::make_shared<IntegerType>(5)));
+    seeds.push_back({ "set-read-only", packet });
+
+    // Every value type, as a manager would get them back
+    packet = make_request(GetResponsePDU, SNMP_VERSION_2C, "public");
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.1"), std::make_shared<Counter32>(7)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.2"), std::make_shared<Gauge>(8)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.3"), std::make_shared<Counter64>(0x123456789aULL)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.4"), std::make_shared<TimestampType>(1000)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.5"), std::make_shared<OpaqueType>(opaqueValue, sizeof(opaqueValue))));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.6"), std::make_shared<NetworkAddress>(IPAddress(192, 168, 1, 1))));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.7"), std::make_shared<OIDType>(".1.3.6.1.4.1.52420")));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.8"), std::make_shared<ImplicitNullType>(NOSUCHOBJECT)));
+    seeds.push_back({ "response", packet });
+
+    packet = make_request(Trapv2PDU, SNMP_VERSION_2C, "public");
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.2.1.1.3.0"), std::make_shared<TimestampType>(1000)));
+    packet->varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.6.3.1.1.4.1.0"), std::make_shared<OIDType>(".1.3.6.1.4.1.5.0.1")));
+    seeds.push_back({ "trapv2", packet });
+
+    int written = 0;
+    for(auto& seed : seeds){
+        uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+        int length = seed.second->serialiseInto(buffer, sizeof(buffer));
+        delete seed.second;
+        if(length <= 0){
+            fprintf(stderr, "couldn't encode seed %s\n", seed.first.c_str());
+            continue;
+        }
+
+        std::string path = std::string(dir) + "/" + seed.first;
+        FILE* file = fopen(path.c_str(), "wb");
+        if(!file || fwrite(buffer, 1, length, file) != (size_t)length){
+            perror(path.c_str());
+            if(file) fclose(file);
+            return 1;
+        }
+        fclose(file);
+        written++;
+    }
+    printf("wrote %d seeds to %s\n", written, dir);
+    return 0;
+}
+
+static int run_file(const std::string& path){
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file){
+        perror(path.c_str());
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[512];
+    size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + read);
+    fclose(file);
+
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+    return 0;
+}
+
+// Replays each file given, or every file in each directory given, through the target
+int main(int argc, char** argv){
+    if(argc == 3 && strcmp(argv[1], "--write-seeds") == 0) return write_seeds(argv[2]);
+    if(argc < 2){
+        printf("usage: %s FILE|DIR...\n       %s --write-seeds DIR\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    int count = 0;
+    for(int i = 1; i < argc; i++){
+        struct stat info;
+        if(stat(argv[i], &info) != 0){
+            perror(argv[i]);
+            return 1;
+        }
+        if(!S_ISDIR(info.st_mode)){
+            if(run_file(argv[i])) return 1;
+            count++;
+            continue;
+        }
+
+        DIR* dir = opendir(argv[i]);
+        struct dirent* entry;
+        while(dir && (entry = readdir(dir))){
+            if(entry->d_name[0] == '.') continue;
+            if(run_file(std::string(argv[i]) + "/" + entry->d_name)) return 1;
+            count++;
+        }
+        if(dir) closedir(dir);
+    }
+    printf("%d inputs ran cleanly\n", count);
+    return 0;
+}
+#endif
@@ -0,0 +1,504 @@
+#include "include/SNMPPacket.h"
+#include "include/BER.h"
+
+// Host side load generator, fires GET/GETNEXT/GETBULK requests at an agent (like the mock) over real UDP and
+// reports throughput, latency and how many never got an answer. Requests are either made up from a mix of types over
+// a range of OIDs, or replayed from a pcap of real traffic.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <deque>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+struct Options {
+    const char* host = "127.0.0.1";
+    int port = 161;
+    const char* community = nullptr;    // "public" for synthesised requests, whatever was captured for a replay
+    double rate = 0;                    // requests per second, 0 to send as fast as the window allows
+    double duration = 10;               // seconds
+    unsigned int window = 64;           // most requests waiting on a response at once
+    unsigned int timeoutMs = 1000;
+
+    // Synthesised traffic, weights of each request type
+    unsigned int getWeight = 8;
+    unsigned int getNextWeight = 1;
+    unsigned int getBulkWeight = 1;
+    const char* oidPrefix = ".1.3.6.1.4.1.5.";
+    unsigned int oidCount = 29999;
+    unsigned int varbinds = 1;
+    unsigned int maxRepetitions = 10;
+
+    // Replay
+    const char* pcap = nullptr;
+    int pcapPort = 161;
+
+    // Fail the run (exit 1) past either of these, for catching regressions
+    double maxDropPercent = -1;
+    long maxP99Us = -1;
+};
+
+static void usage(const char* name){
+    printf("usage: %s [options]\n"
+           "  --host ADDR            agent address (127.0.0.1)\n"
+           "  --port N               agent port (161)\n"
+           "  --community NAME       community to use (public, or as captured when replaying)\n"
+           "  --rate N               requests per second, 0 for as fast as the window allows (0)\n"
+           "  --duration SECONDS     how long to send for (10)\n"
+           "  --window N             most requests outstanding at once (64)\n"
+           "  --timeout MS           how long before a request counts as dropped (1000)\n"
+           "  --mix GET,NEXT,BULK    weights of each request type (8,1,1)\n"
+           "  --oid-prefix OID       requests go to <prefix><1..count> (.1.3.6.1.4.1.5.)\n"
+           "  --oid-count N          (29999)\n"
+           "  --varbinds N           varbinds per request (1)\n"
+           "  --max-repetitions N    for GETBULK (10)\n"
+           "  --pcap FILE            replay the requests in a capture instead, looping over them\n"
+           "  --pcap-port N          port the captured requests were sent to (161)\n"
+           "  --max-drop PERCENT     exit 1 if more than this many requests go unanswered\n"
+           "  --max-p99 US           exit 1 if the 99th percentile latency (from when due, with a rate) is over this\n", name);
+}
+
+static bool parse_options(int argc, char** argv, Options& options){
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--help" || i + 1 >= argc) return false;
+        const char* value = argv[++i];
+
+        if(arg == "--host") options.host = value;
+        else if(arg == "--port") options.port = atoi(value);
+        else if(arg == "--community") options.community = value;
+        else if(arg == "--rate") options.rate = atof(value);
+        else if(arg == "--duration") options.duration = atof(value);
+        else if(arg == "--window") options.window = std::max(1, atoi(value));
+        else if(arg == "--timeout") options.timeoutMs = atoi(value);
+        else if(arg == "--mix"){
+            if(sscanf(value, "%u,%u,%u", &options.getWeight, &options.getNextWeight, &options.getBulkWeight) != 3) return false;
+            if(!options.getWeight && !options.getNextWeight && !options.getBulkWeight) return false;
+        }
+        else if(arg == "--oid-prefix") options.oidPrefix = value;
+        else if(arg == "--oid-count") options.oidCount = std::max(1, atoi(value));
+        else if(arg == "--varbinds") options.varbinds = std::max(1, atoi(value));
+        else if(arg == "--max-repetitions") options.maxRepetitions = atoi(value);
+        else if(arg == "--pcap") options.pcap = value;
+        else if(arg == "--pcap-port") options.pcapPort = atoi(value);
+        else if(arg == "--max-drop") options.maxDropPercent = atof(value);
+        else if(arg == "--max-p99") options.maxP99Us = atol(value);
+        else return false;
+    }
+    return true;
+}
+
+// Where the requestID's value is in an encoded packet, and how long it is
+static bool find_request_id(const uint8_t* buf, size_t len, size_t* offset, size_t* length){
+    ASN_TYPE type;
+    size_t valueLength;
+    size_t pos = 0;
+
+    int i = decode_ber_header(buf, len, &type, &valueLength);
+    if(i < 0 || type != STRUCTURE) return false;
+    pos += i;
+
+    // version and community
+    for(int skip = 0; skip < 2; skip++){
+        i = decode_ber_header(buf + pos, len - pos, &type, &valueLength);
+        if(i < 0 || pos + i + valueLength > len) return false;
+        pos += i + valueLength;
+    }
+
+    i = decode_ber_header(buf + pos, len - pos, &type, &valueLength);
+    if(i < 0 || type < ASN_PDU_TYPE_MIN_VALUE || type > ASN_PDU_TYPE_MAX_VALUE) return false;
+    pos += i;
+
+    i = decode_ber_header(buf + pos, len - pos, &type, &valueLength);
+    if(i < 0 || type != INTEGER || valueLength < 1 || valueLength > 4 || pos + i + valueLength > len) return false;
+    *offset = pos + i;
+    *length = valueLength;
+    return true;
+}
+
+// A request ready to send, only its requestID changes from one send to the next.
+// SNMPPacket always writes integers as 4 bytes, so there's always room for any requestID
+struct RequestTemplate {
+    std::vector<uint8_t> encoded;
+    size_t requestIDOffset;
+    ASN_TYPE pduType;
+};
+
+static bool make_template(SNMPPacket& request, RequestTemplate& out){
+    uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+    int length = request.serialiseInto(buffer, MAX_SNMP_PACKET_LENGTH);
+    if(length <= 0) return false;
+
+    size_t requestIDLength;
+    out.encoded.assign(buffer, buffer + length);
+    out.pduType = request.packetPDUType;
+    return find_request_id(buffer, length, &out.requestIDOffset, &requestIDLength) && requestIDLength == 4;
+}
+
+static std::vector<RequestTemplate> synthesise_requests(const Options& options){
+    // Enough different requests that the agent can't get lucky with its caches, each one a random draw from the mix
+    const int count = 4096;
+    std::mt19937 random(42);
+    std::discrete_distribution<int> types({ (double)options.getWeight, (double)options.getNextWeight, (double)options.getBulkWeight });
+    std::uniform_int_distribution<unsigned int> oids(1, options.oidCount);
+    static const ASN_TYPE pduTypes[] = { GetRequestPDU, GetNextRequestPDU, GetBulkRequestPDU };
+
+    std::vector<RequestTemplate> requests;
+    for(int i = 0; i < count; i++){
+        SNMPPacket request;
+        request.setPDUType(pduTypes[types(random)]);
+        request.setCommunityString(options.community ? options.community : "public");
+        request.setRequestID(1);
+        request.setVersion(SNMP_VERSION_2C);
+        if(request.packetPDUType == GetBulkRequestPDU){
+            request.errorStatus.nonRepeaters = 0;
+            request.errorIndex.maxRepititions = options.maxRepetitions;
+        }
+        for(unsigned int v = 0; v < options.varbinds; v++){
+            std::string oid = options.oidPrefix + std::to_string(oids(random));
+            request.varbindList.push_back(VarBind(std::make_shared<OIDType>(oid), std::make_shared<NullType>()));
+        }
+
+        RequestTemplate prepared;
+        if(!make_template(request, prepared)){
+            fprintf(stderr, "couldn't encode request, too many varbinds?\n");
+            return {};
+        }
+        requests.push_back(std::move(prepared));
+    }
+    return requests;
+}
+
+static uint32_t read32(const uint8_t* ptr, bool swapped){
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return swapped ? __builtin_bswap32(value) : value;
+}
+
+// The UDP payload of a captured frame, if it's a datagram to port
+static bool udp_payload(const uint8_t* frame, size_t len, uint32_t linkType, int port, const uint8_t** payload, size_t* payloadLength){
+    size_t pos;
+    uint16_t etherType;
+    switch(linkType){
+        case 1:     // Ethernet, possibly VLAN tagged
+            if(len < 14) return false;
+            pos = 12;
+            etherType = (frame[pos] << 8) | frame[pos + 1];
+            while(etherType == 0x8100 && pos + 6 <= len){
+                pos += 4;
+                etherType = (frame[pos] << 8) | frame[pos + 1];
+            }
+            pos += 2;
+            break;
+        case 113:   // Linux cooked
+            if(len < 16) return false;
+            etherType = (frame[14] << 8) | frame[15];
+            pos = 16;
+            break;
+        case 276:   // Linux cooked v2
+            if(len < 20) return false;
+            etherType = (frame[0] << 8) | frame[1];
+            pos = 20;
+            break;
+        case 101:   // Raw IP
+        case 12:
+            if(len < 1) return false;
+            etherType = (frame[0] >> 4) == 6 ? 0x86dd : 0x0800;
+            pos = 0;
+            break;
+        default:
+            return false;
+    }
+
+    if(etherType == 0x0800){
+        if(pos + 20 > len || frame[pos + 9] != 17) return false;
+        // Fragments other than the first don't start with a UDP header
+        if(((frame[pos + 6] & 0x1f) | frame[pos + 7]) != 0) return false;
+        pos += (frame[pos] & 0x0f) * 4;
+    } else if(etherType == 0x86dd){
+        // Extension headers aren't followed, requests don't tend to carry them
+        if(pos + 40 > len || frame[pos + 6] != 17) return false;
+        pos += 40;
+    } else {
+        return false;
+    }
+
+    if(pos + 8 > len) return false;
+    int dstPort = (frame[pos + 2] << 8) | frame[pos + 3];
+    size_t udpLength = (frame[pos + 4] << 8) | frame[pos + 5];
+    if(dstPort != port || udpLength < 8 || pos + udpLength > len) return false;
+
+    *payload = frame + pos + 8;
+    *payloadLength = udpLength - 8;
+    return true;
+}
+
+// The GET/GETNEXT/GETBULK requests from a classic libpcap file, anything else in it is skipped (including SETs, a replay shouldn't change anything)
+static std::vector<RequestTemplate> load_pcap(const Options& options){
+    std::vector<RequestTemplate> requests;
+    FILE* file = fopen(options.pcap, "rb");
+    if(!file){
+        perror("couldn't open pcap");
+        return requests;
+    }
+
+    uint8_t header[24];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header)){
+        fprintf(stderr, "pcap too short\n");
+        fclose(file);
+        return requests;
+    }
+    uint32_t magic = read32(header, false);
+    bool swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    if(!swapped && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d){
+        fprintf(stderr, "not a pcap file (pcapng isn't supported, convert it with editcap -F pcap)\n");
+        fclose(file);
+        return requests;
+    }
+    uint32_t linkType = read32(header + 20, swapped) & 0xffff;
+
+    unsigned long frames = 0, skipped = 0;
+    std::vector<uint8_t> frame;
+    uint8_t recordHeader[16];
+    while(fread(recordHeader, 1, sizeof(recordHeader), file) == sizeof(recordHeader)){
+        uint32_t capturedLength = read32(recordHeader + 8, swapped);
+        if(capturedLength > 256 * 1024) break;
+        frame.resize(capturedLength);
+        if(fread(frame.data(), 1, capturedLength, file) != capturedLength) break;
+        frames++;
+
+        const uint8_t* payload;
+        size_t payloadLength;
+        if(!udp_payload(frame.data(), capturedLength, linkType, options.pcapPort, &payload, &payloadLength)) continue;
+
+        // Decoded and encoded again to get a 4 byte requestID we can patch
+        SNMPPacket request;
+        std::vector<uint8_t> copy(payload, payload + payloadLength);
+        if(request.parseFrom(copy.data(), copy.size()) <= 0 || (request.packetPDUType != GetRequestPDU &&
+           request.packetPDUType != GetNextRequestPDU && request.packetPDUType != GetBulkRequestPDU)){
+            skipped++;
+            continue;
+        }
+        if(options.community) request.setCommunityString(options.community);
+
+        RequestTemplate prepared;
+        if(!make_template(request, prepared)){
+            skipped++;
+            continue;
+        }
+        requests.push_back(std::move(prepared));
+    }
+    fclose(file);
+
+    printf("%lu frames read, %lu requests to replay, %lu other SNMP packets skipped\n", frames, (unsigned long)requests.size(), skipped);
+    return requests;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t now_us(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Outstanding {
+    uint64_t sentAt;
+    // When it should have gone out at the given rate, latency counts from here so time spent waiting behind a slow
+    // agent isn't left out (coordinated omission). The same as sentAt without a rate
+    uint64_t scheduledAt;
+    int type;           // index into the per type counts, PDU type less GetRequestPDU
+};
+
+struct TypeCounts {
+    unsigned long sent = 0;
+    unsigned long received = 0;
+};
+
+static uint32_t percentile(std::vector<uint32_t>& latencies, unsigned int percent){
+    if(latencies.empty()) return 0;
+    size_t index = std::min(latencies.size() - 1, (latencies.size() * percent + 99) / 100 - 1);
+    std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+    return latencies[index];
+}
+
+int main(int argc, char** argv){
+    Options options;
+    if(!parse_options(argc, argv, options)){
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<RequestTemplate> requests = options.pcap ? load_pcap(options) : synthesise_requests(options);
+    if(requests.empty()){
+        fprintf(stderr, "nothing to send\n");
+        return 2;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if(sock < 0){
+        perror("socket");
+        return 2;
+    }
+    // Plenty of room for a window's worth of responses arriving while we're busy sending
+    int bufferSize = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    struct sockaddr_in agent = {};
+    agent.sin_family = AF_INET;
+    agent.sin_port = htons(options.port);
+    if(inet_pton(AF_INET, options.host, &agent.sin_addr) != 1){
+        fprintf(stderr, "bad address: %s\n", options.host);
+        return 2;
+    }
+    // Connected, so the kernel drops anything that isn't from the agent
+    if(connect(sock, (struct sockaddr*)&agent, sizeof(agent)) < 0){
+        perror("connect");
+        return 2;
+    }
+
+    printf("sending to %s:%d for %.1fs, rate %s, window %u\n", options.host, options.port, options.duration,
+        options.rate > 0 ? std::to_string((long)options.rate).c_str() : "unlimited", options.window);
+
+    std::unordered_map<uint32_t, Outstanding> outstanding;
+    // requestIDs in the order they were sent, so timeouts can be found from the front
+    std::deque<uint32_t> sendOrder;
+    std::vector<uint32_t> latencies;
+    // From when each request actually went out, only reported alongside latencies when there's a rate
+    std::vector<uint32_t> sendLatencies;
+    TypeCounts counts[3];
+    unsigned long sent = 0, received = 0, dropped = 0, sendErrors = 0, unexpected = 0;
+
+    const uint64_t start = now_us();
+    const uint64_t end = start + (uint64_t)(options.duration * 1e6);
+    const uint64_t timeout = (uint64_t)options.timeoutMs * 1000;
+    uint32_t nextRequestID = 1;
+    size_t nextRequest = 0;
+    uint8_t response[MAX_SNMP_PACKET_LENGTH];
+
+    while(true){
+        uint64_t now = now_us();
+        bool sending = now < end;
+        if(!sending && outstanding.empty()) break;
+
+        // Open loop at the given rate, the n-th request goes out at start + n / rate however late the ones before it were
+        while(sending && outstanding.size() < options.window){
+            uint64_t scheduledAt = options.rate > 0 ? start + (uint64_t)(sent * 1e6 / options.rate) : now;
+            if(now < scheduledAt) break;
+
+            RequestTemplate& request = requests[nextRequest];
+            nextRequest = (nextRequest + 1) % requests.size();
+            uint32_t requestID = nextRequestID++;
+            // Kept clear of 0 and the sign bit, some agents choke on negative requestIDs
+            if(nextRequestID > 0x7fffffff) nextRequestID = 1;
+            uint8_t* id = request.encoded.data() + request.requestIDOffset;
+            id[0] = requestID >> 24;
+            id[1] = requestID >> 16;
+            id[2] = requestID >> 8;
+            id[3] = requestID;
+
+            if(send(sock, request.encoded.data(), request.encoded.size(), 0) < 0){
+                sendErrors++;
+                break;
+            }
+            int type = request.pduType == GetBulkRequestPDU ? 2 : request.pduType - GetRequestPDU;
+            outstanding[requestID] = { now, scheduledAt, type };
+            sendOrder.push_back(requestID);
+            counts[type].sent++;
+            sent++;
+        }
+
+        ssize_t length;
+        while((length = recv(sock, response, sizeof(response), 0)) > 0){
+            uint64_t receivedAt = now_us();
+            size_t offset, idLength;
+            if(!find_request_id(response, length, &offset, &idLength)){
+                unexpected++;
+                continue;
+            }
+            uint32_t requestID = 0;
+            for(size_t i = 0; i < idLength; i++) requestID = (requestID << 8) | response[offset + i];
+
+            auto it = outstanding.find(requestID);
+            if(it == outstanding.end()){
+                // Late (already counted as dropped) or a duplicate
+                unexpected++;
+                continue;
+            }
+            latencies.push_back((uint32_t)std::min<uint64_t>(receivedAt - it->second.scheduledAt, UINT32_MAX));
+            sendLatencies.push_back((uint32_t)std::min<uint64_t>(receivedAt - it->second.sentAt, UINT32_MAX));
+            counts[it->second.type].received++;
+            received++;
+            outstanding.erase(it);
+        }
+
+        now = now_us();
+        while(!sendOrder.empty()){
+            auto it = outstanding.find(sendOrder.front());
+            if(it == outstanding.end()){
+                sendOrder.pop_front();
+                continue;
+            }
+            if(now - it->second.sentAt < timeout) break;
+            outstanding.erase(it);
+            sendOrder.pop_front();
+            dropped++;
+        }
+
+        // Sleep until the next request is due or a response turns up, whichever's first
+        int waitMs = 1;
+        if(sending && options.rate > 0 && outstanding.size() < options.window){
+            uint64_t due = start + (uint64_t)(sent * 1e6 / options.rate);
+            waitMs = due > now ? (int)std::min<uint64_t>((due - now) / 1000, 1) : 0;
+        } else if(sending && outstanding.size() < options.window){
+            waitMs = 0;
+        }
+        if(waitMs){
+            struct pollfd pfd = { sock, POLLIN, 0 };
+            poll(&pfd, 1, waitMs);
+        }
+    }
+    close(sock);
+
+    double elapsed = (now_us() - start) / 1e6;
+    double dropPercent = sent ? 100.0 * dropped / sent : 0;
+    uint32_t p50 = percentile(latencies, 50);
+    uint32_t p90 = percentile(latencies, 90);
+    uint32_t p99 = percentile(latencies, 99);
+    uint32_t max = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+
+    static const char* typeNames[] = { "GET", "GETNEXT", "GETBULK" };
+    printf("\n%-10s %12s %12s\n", "", "sent", "answered");
+    for(int type = 0; type < 3; type++){
+        if(counts[type].sent) printf("%-10s %12lu %12lu\n", typeNames[type], counts[type].sent, counts[type].received);
+    }
+    printf("\nsent %lu, answered %lu, dropped %lu (%.2f%%), send errors %lu, unexpected responses %lu\n",
+        sent, received, dropped, dropPercent, sendErrors, unexpected);
+    printf("throughput %.0f responses/s over %.1fs\n", received / elapsed, elapsed);
+    if(options.rate > 0){
+        printf("latency p50 %uus, p90 %uus, p99 %uus, max %uus (from when each request was due)\n", p50, p90, p99, max);
+        uint32_t sendMax = sendLatencies.empty() ? 0 : *std::max_element(sendLatencies.begin(), sendLatencies.end());
+        printf("        p50 %uus, p90 %uus, p99 %uus, max %uus (from when it was sent)\n",
+            percentile(sendLatencies, 50), percentile(sendLatencies, 90), percentile(sendLatencies, 99), sendMax);
+    } else {
+        printf("latency p50 %uus, p90 %uus, p99 %uus, max %uus\n", p50, p90, p99, max);
+    }
+
+    bool failed = false;
+    if(options.maxDropPercent >= 0 && dropPercent > options.maxDropPercent){
+        printf("FAIL: drop rate over %.2f%%\n", options.maxDropPercent);
+        failed = true;
+    }
+    if(options.maxP99Us >= 0 && p99 > (uint32_t)options.maxP99Us){
+        printf("FAIL: p99 over %ldus\n", options.maxP99Us);
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
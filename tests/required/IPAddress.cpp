@@ -1,4 +1,4 @@
-#ifdef COMPILING_TESTS
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
 
 #include "IPAddress.h"
 #include <string.h>
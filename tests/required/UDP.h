@@ -1,24 +1,26 @@
 #ifndef UDP_h
 #define UDP_h
 
-#ifdef COMPILING_TESTS
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
 
 #include "tests/required/IPAddress.h"
 #include <stddef.h>
 
+// Virtual like Arduino's UDP, so tests and host builds can provide their own
 class UDP {
   public:
-    void begin(int){};
-    int parsePacket(){ return 0; }
-    void beginPacket(IPAddress, uint16_t){};
-    int endPacket(){ return 1; };
-    void write(uint8_t*, size_t){};
-    void stop(){};
-    int read(uint8_t*, int){ return 0; }
-    IPAddress remoteIP(){return IPAddress();}
-    int remotePort(){return 0;}
+    virtual ~UDP(){};
+    virtual void begin(int){};
+    virtual int parsePacket(){ return 0; }
+    virtual void beginPacket(IPAddress, uint16_t){};
+    virtual int endPacket(){ return 1; };
+    virtual void write(const uint8_t*, size_t){};
+    virtual void stop(){};
+    virtual int read(uint8_t*, int){ return 0; }
+    virtual IPAddress remoteIP(){return IPAddress();}
+    virtual int remotePort(){return 0;}
 
 };
 
 #endif
-#endif
\ No newline at end of file
+#endif
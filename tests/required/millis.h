@@ -5,8 +5,38 @@
 #ifndef ARDUINO_SNMP2_MILLIS_H
 #define ARDUINO_SNMP2_MILLIS_H
 
+#if defined(COMPILING_TESTS) || defined(SNMP_HOST_LINUX)
+// The real monotonic clock, for host builds that run an actual agent
+#include <chrono>
+inline unsigned long host_millis(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline unsigned long host_micros(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Tests still time how long things take with the real clock
+#define micros() host_micros()
+
 #ifdef COMPILING_TESTS
-#define millis() (unsigned long)0
+#include <atomic>
+// Stands still unless a test moves it along with test_millis() = ..., or has it tick on by test_millis_step() every time it's read.
+// Atomic as worker pool threads read it too
+inline std::atomic<unsigned long>& test_millis(){
+    static std::atomic<unsigned long> now(0);
+    return now;
+}
+inline std::atomic<unsigned long>& test_millis_step(){
+    static std::atomic<unsigned long> step(0);
+    return step;
+}
+inline unsigned long test_millis_read(){
+    return test_millis().fetch_add(test_millis_step());
+}
+#define millis() test_millis_read()
+#else
+#define millis() host_millis()
+#endif
 #endif
 
 #endif //ARDUINO_SNMP2_MILLIS_H
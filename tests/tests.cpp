@@ -4,18 +4,22 @@
 #include "include/SNMPPacket.h"
 #include "include/ValueCallbacks.h"
 #include "include/SNMPParser.h"
+#include "include/AllocStats.h"
 
 #include "SNMPTrap.h"
+#include "SNMP_Agent.h"
+#include "SNMPWorkerPool.h"
+#include "TestRequest.h"
 
+#include <atomic>
 #include <list>
+#include <set>
+#include <thread>
+#include <vector>
 
 static SNMPPacket* GenerateTestSNMPRequestPacket(){
     SNMPPacket* packet = new SNMPPacket();
-
-    packet->setPDUType(GetRequestPDU);
-    packet->setCommunityString("public");
-    packet->setRequestID(random());
-    packet->setVersion(SNMP_VERSION_1);
+    SetupTestSNMPRequest(*packet, GetRequestPDU, SNMP_VERSION_1, "public", random());
 
     packet->varbindList.push_back(VarBind(std::make_shared<SortableOIDType>(".1.3.6.1.4.1.5.1"),                  std::make_shared<IntegerType>(42)));
     packet->varbindList.push_back(VarBind(std::make_shared<SortableOIDType>(".1.3.6.1.4.1.5.2"),                  std::make_shared<OctetType>("test 123")));
@@ -26,6 +30,38 @@ static SNMPPacket* GenerateTestSNMPRequestPacket(){
     return packet;
 }
 
+// Stands in for a socket with a queue of datagrams waiting on it, keeping whatever gets sent back
+class QueuedUDP: public UDP {
+  public:
+    std::deque<std::vector<uint8_t>> received;
+    std::vector<std::vector<uint8_t>> sent;
+
+    int parsePacket() override {
+        current.clear();
+        if(received.empty()) return 0;
+        current = received.front();
+        received.pop_front();
+        return current.size();
+    }
+    int read(uint8_t* buf, int len) override {
+        int n = std::min(len, (int)current.size());
+        memcpy(buf, current.data(), n);
+        return n;
+    }
+    void write(const uint8_t* buf, size_t len) override {
+        sent.push_back(std::vector<uint8_t>(buf, buf + len));
+    }
+
+    void queueRequest(SNMPPacket* packet){
+        uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+        int length = packet->serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+        received.push_back(std::vector<uint8_t>(buf, buf + length));
+    }
+
+  private:
+    std::vector<uint8_t> current;
+};
+
 TEST_CASE( "Test handle failures when Encoding/Decoding", "[snmp]"){
     SNMPPacket *packet = GenerateTestSNMPRequestPacket();
     uint8_t buffer[500];
@@ -55,6 +91,8 @@ TEST_CASE( "Test handle failures when Encoding/Decoding", "[snmp]"){
     }
     
     SECTION( "Should be able to reparse the buffer with correct max_size"){
+        // Each section runs on its own, so this one has to serialise it too
+        REQUIRE( packet->serialiseInto(buffer, 133) == 133 );
         SNMPPacket* readPack = new SNMPPacket();
         REQUIRE( readPack->parseFrom(buffer, 133) == SNMP_ERROR_OK );
     }
@@ -123,6 +161,41 @@ TEST_CASE( "Test Encoding/Decoding packet", "[snmp]" ) {
         REQUIRE( std::static_pointer_cast<IntegerType>(packet->varbindList[4].value)->_value == -420000 );
 }
 
+TEST_CASE( "OIDs format without keeping the string", "[snmp]" ) {
+    SNMPPacket *packet = GenerateTestSNMPRequestPacket();
+    uint8_t buffer[500];
+    int length = packet->serialiseInto(buffer, 500);
+    delete packet;
+
+    SNMPPacket decoded;
+    REQUIRE( decoded.parseFrom(buffer, length) == SNMP_ERROR_OK );
+    OIDType* oid = decoded.varbindList[2].oid.get();
+
+    REQUIRE( std::string(oid->format().c_str()) == ".1.3.6.1.4.1.52420.9999999" );
+    // A copy made before string() has nothing cached, format() can't have filled it in either
+    std::shared_ptr<OIDType> copy = oid->cloneOID();
+    REQUIRE( std::string(copy->format().c_str()) == ".1.3.6.1.4.1.52420.9999999" );
+    REQUIRE( oid->string() == ".1.3.6.1.4.1.52420.9999999" );
+    REQUIRE( std::string(oid->format().c_str()) == oid->string() );
+
+    SECTION( "Long OIDs are cut short" ){
+        std::string longOID = ".1.3.6.1.4.1";
+        for(int i = 0; i < 40; i++) longOID += ".123456";
+        SNMPPacket request;
+        SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 1, {longOID});
+        length = request.serialiseInto(buffer, 500);
+
+        SNMPPacket longDecoded;
+        REQUIRE( longDecoded.parseFrom(buffer, length) == SNMP_ERROR_OK );
+        std::string formatted = longDecoded.varbindList[0].oid->format().c_str();
+        REQUIRE( formatted.length() == SNMP_OID_STRING_LENGTH - 1 );
+        REQUIRE( formatted.substr(formatted.length() - 3) == "..." );
+        // string() isn't limited
+        REQUIRE( longDecoded.varbindList[0].oid->string() == longOID );
+        REQUIRE( formatted.substr(0, 20) == longOID.substr(0, 20) );
+    }
+}
+
 TEST_CASE( "Test GetRequestPDU", "[snmp]" ){
     std::deque<ValueCallback*> callbacks;
 
@@ -145,6 +218,236 @@ TEST_CASE( "Test GetRequestPDU", "[snmp]" ){
     REQUIRE( std::static_pointer_cast<IntegerType>(responsePacket->varbindList.at(0).value)->_value == 23 );
 }
 
+TEST_CASE( "Test SNMPResponseWriter matches SNMPResponse encoding", "[snmp]" ){
+    std::deque<ValueCallback*> callbacks;
+
+    int testInt = -23;
+    std::string longString(300, 'x');
+    uint64_t testCounter64 = 0x0102030405060708;
+    uint8_t opaqueBuf[5] = { 1, 2, 3, 4, 5 };
+
+    callbacks.push_back(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &testInt));
+    callbacks.push_back(new ReadOnlyStringCallback(new SortableOIDType(".1.3.6.1.4.1.5.2"), longString));
+    callbacks.push_back(new Counter64Callback(new SortableOIDType(".1.3.6.1.4.1.5.3"), &testCounter64));
+    callbacks.push_back(new OpaqueCallback(new SortableOIDType(".1.3.6.1.4.1.5.4"), opaqueBuf, 5));
+    callbacks.push_back(new Counter32Callback(new SortableOIDType(".1.3.6.1.4.1.5.5"), nullptr));
+
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 1234);
+
+    // Build the expected response the old way through containers, alongside the direct writer
+    SNMPResponse expected(request);
+
+    uint8_t buffer[1400];
+    SNMPResponseWriter writer(buffer, 1400);
+    REQUIRE( writer.begin(request) );
+
+    for(auto callback : callbacks){
+        auto value = ValueCallback::getValueForCallback(callback);
+        if(value){
+            expected.addResponse(VarBind(callback->OID, value));
+            REQUIRE( writer.addVarBind(callback->OID, callback) == SNMP_ERROR_OK );
+        } else {
+            expected.addErrorResponse(VarBind(callback->OID, GEN_ERR));
+            REQUIRE( writer.addVarBind(callback->OID, callback) == SNMP_BUFFER_ENCODE_ERROR_INVALID_ITEM );
+            REQUIRE( writer.addErrorVarBind(callback->OID, GEN_ERR) == SNMP_ERROR_OK );
+        }
+    }
+    auto missing = std::make_shared<OIDType>(".1.3.6.1.4.1.6.1");
+    expected.addResponse(VarBind(missing, std::make_shared<ImplicitNullType>(NOSUCHOBJECT)));
+    REQUIRE( writer.addNullVarBind(missing.get(), NOSUCHOBJECT) == SNMP_ERROR_OK );
+
+    uint8_t expectedBuffer[1400];
+    int expectedLength = expected.serialiseInto(expectedBuffer, 1400);
+    REQUIRE( expectedLength > 0 );
+
+    REQUIRE( writer.finish() == expectedLength );
+    REQUIRE( memcmp(buffer, expectedBuffer, expectedLength) == 0 );
+
+    SECTION( "Overflowing the buffer is reported" ){
+        uint8_t smallBuffer[200];
+        SNMPResponseWriter smallWriter(smallBuffer, 200);
+        REQUIRE( smallWriter.begin(request) );
+        REQUIRE( smallWriter.addVarBind(callbacks[0]->OID, callbacks[0]) == SNMP_ERROR_OK );
+        REQUIRE( smallWriter.addVarBind(callbacks[1]->OID, callbacks[1]) == SNMP_BUFFER_ENCODE_ERR_LEN_EXCEEDED );
+        REQUIRE( smallWriter.overflowed );
+
+        // Which leaves a tooBig with nothing in it
+        int length = smallWriter.finish();
+        REQUIRE( length > 0 );
+        SNMPPacket tooBig;
+        REQUIRE( tooBig.parseFrom(smallBuffer, length) == SNMP_ERROR_OK );
+        REQUIRE( tooBig.errorStatus.errorStatus == TOO_BIG );
+        REQUIRE( tooBig.errorIndex.errorIndex == 0 );
+        REQUIRE( tooBig.varbindList.empty() );
+    }
+}
+
+TEST_CASE( "Test GetRequestPDU answered in place", "[snmp]" ){
+    std::deque<ValueCallback*> callbacks;
+
+    int testInt = 23;
+    std::string longString(300, 'x');
+    callbacks.push_back(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &testInt));
+    callbacks.push_back(new ReadOnlyStringCallback(new SortableOIDType(".1.3.6.1.4.1.5.2"), longString));
+    callbacks.push_back(new Counter32Callback(new SortableOIDType(".1.3.6.1.4.1.5.3"), nullptr));
+
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 4321);
+    for(auto callback : callbacks){
+        request.varbindList.push_back(VarBind(callback->OID, std::make_shared<NullType>()));
+    }
+    auto missing = std::make_shared<OIDType>(".1.3.6.1.4.1.6.1");
+    request.varbindList.push_back(VarBind(missing, std::make_shared<NullType>()));
+
+    uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+    int buf_len = request.serialiseInto(buffer, MAX_SNMP_PACKET_LENGTH);
+    REQUIRE( buf_len > 0 );
+
+    // What the full path would have encoded
+    SNMPResponse expected(request);
+    expected.addResponse(VarBind(callbacks[0]->OID, ValueCallback::getValueForCallback(callbacks[0])));
+    expected.addResponse(VarBind(callbacks[1]->OID, ValueCallback::getValueForCallback(callbacks[1])));
+    expected.addErrorResponse(VarBind(callbacks[2]->OID, GEN_ERR));
+    expected.addResponse(VarBind(missing, std::make_shared<ImplicitNullType>(NOSUCHOBJECT)));
+
+    uint8_t expectedBuffer[MAX_SNMP_PACKET_LENGTH];
+    int expectedLength = expected.serialiseInto(expectedBuffer, MAX_SNMP_PACKET_LENGTH);
+    REQUIRE( expectedLength > 0 );
+
+    int responseLength = 0;
+    REQUIRE( handleGetRequestInPlace(buffer, buf_len, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks, "public", "private") == SNMP_GET_OCCURRED );
+    REQUIRE( responseLength == expectedLength );
+    REQUIRE( memcmp(buffer, expectedBuffer, expectedLength) == 0 );
+
+    SECTION( "Leaves anything but a GetRequest with a valid community alone" ){
+        request.setPDUType(GetNextRequestPDU);
+        buf_len = request.serialiseInto(buffer, MAX_SNMP_PACKET_LENGTH);
+        uint8_t copyBuffer[MAX_SNMP_PACKET_LENGTH];
+        memcpy(copyBuffer, buffer, buf_len);
+
+        REQUIRE( handleGetRequestInPlace(buffer, buf_len, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks, "public", "private") == SNMP_NO_PACKET );
+        REQUIRE( memcmp(copyBuffer, buffer, buf_len) == 0 );
+
+        request.setPDUType(GetRequestPDU);
+        buf_len = request.serialiseInto(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( handleGetRequestInPlace(buffer, buf_len, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks, "other", "") == SNMP_NO_PACKET );
+    }
+}
+
+TEST_CASE( "Responses that don't fit are answered with tooBig", "[snmp]" ){
+    std::deque<ValueCallback*> callbacks;
+    std::string longString(300, 'x');
+    for(int i = 1; i <= 6; i++){
+        callbacks.push_back(new ReadOnlyStringCallback(new SortableOIDType(".1.3.6.1.4.1.5." + std::to_string(i)), longString));
+    }
+    sort_handlers(callbacks);
+
+    SNMPAgentStats stats;
+    uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+    int responseLength = 0;
+
+    // Six of them come to more than a packet
+    auto handle = [&](ASN_TYPE type, SNMP_VERSION version, const std::vector<std::string>& oids, int maxRepetitions){
+        SNMPPacket request;
+        SetupTestSNMPRequest(request, type, version, "public", 99, oids);
+        request.errorIndex.maxRepititions = maxRepetitions;
+        int length = request.serialiseInto(buffer, sizeof(buffer));
+        REQUIRE( length > 0 );
+        responseLength = 0;
+        return handlePacket(buffer, length, &responseLength, sizeof(buffer), callbacks, "private", "public", nullptr, nullptr, &stats);
+    };
+    auto response = [&](SNMPPacket& packet){
+        REQUIRE( responseLength > 0 );
+        REQUIRE( packet.parseFrom(buffer, responseLength) == SNMP_ERROR_OK );
+        REQUIRE( packet.packetPDUType == GetResponsePDU );
+        REQUIRE( packet.requestID == 99 );
+    };
+    std::vector<std::string> all = { ".1.3.6.1.4.1.5.1", ".1.3.6.1.4.1.5.2", ".1.3.6.1.4.1.5.3", ".1.3.6.1.4.1.5.4", ".1.3.6.1.4.1.5.5", ".1.3.6.1.4.1.5.6" };
+    std::vector<std::string> allNext = { ".1.3.6.1.4.1.5", ".1.3.6.1.4.1.5.1", ".1.3.6.1.4.1.5.2", ".1.3.6.1.4.1.5.3", ".1.3.6.1.4.1.5.4", ".1.3.6.1.4.1.5.5" };
+
+    SECTION( "GetRequest, answered in place" ){
+        REQUIRE( handle(GetRequestPDU, SNMP_VERSION_2C, all, 0) == SNMP_ERROR_PACKET_SENT );
+        SNMPPacket packet;
+        response(packet);
+        REQUIRE( packet.errorStatus.errorStatus == TOO_BIG );
+        REQUIRE( packet.errorIndex.errorIndex == 0 );
+        REQUIRE( packet.varbindList.empty() );
+    }
+
+    SECTION( "GetRequest in v1 echoes the request's varbinds" ){
+        REQUIRE( handle(GetRequestPDU, SNMP_VERSION_1, all, 0) == SNMP_ERROR_PACKET_SENT );
+        SNMPPacket packet;
+        response(packet);
+        REQUIRE( packet.snmpVersion == SNMP_VERSION_1 );
+        REQUIRE( packet.errorStatus.errorStatus == TOO_BIG );
+        REQUIRE( packet.errorIndex.errorIndex == 0 );
+        REQUIRE( packet.varbindList.size() == all.size() );
+        for(size_t i = 0; i < all.size(); i++){
+            REQUIRE( packet.varbindList[i].oid->equals(std::make_shared<OIDType>(all[i])) );
+            REQUIRE( packet.varbindList[i].value->_type == NULLTYPE );
+        }
+        REQUIRE( stats.counters[SNMP_OUT_TOO_BIGS] == 1 );
+        REQUIRE( stats.counters[SNMP_IN_GET_REQUESTS] == 1 );
+    }
+
+    SECTION( "GetRequest in v1 that fits is still answered in place" ){
+        SNMPPacket request;
+        SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_1, "public", 99, { ".1.3.6.1.4.1.5.1", ".1.3.6.1.4.1.5.2" });
+        int length = request.serialiseInto(buffer, sizeof(buffer));
+        REQUIRE( handleGetRequestInPlace(buffer, length, &responseLength, sizeof(buffer), callbacks, "private", "public") == SNMP_GET_OCCURRED );
+        SNMPPacket packet;
+        response(packet);
+        REQUIRE( packet.snmpVersion == SNMP_VERSION_1 );
+        REQUIRE( packet.errorStatus.errorStatus == NO_ERROR );
+        REQUIRE( packet.varbindList.size() == 2 );
+        REQUIRE( packet.varbindList[1].oid->equals(callbacks[1]->OID) );
+    }
+
+    SECTION( "GetNextRequest in v2c has no varbinds" ){
+        REQUIRE( handle(GetNextRequestPDU, SNMP_VERSION_2C, allNext, 0) == SNMP_ERROR_PACKET_SENT );
+        SNMPPacket packet;
+        response(packet);
+        REQUIRE( packet.snmpVersion == SNMP_VERSION_2C );
+        REQUIRE( packet.errorStatus.errorStatus == TOO_BIG );
+        REQUIRE( packet.errorIndex.errorIndex == 0 );
+        REQUIRE( packet.varbindList.empty() );
+    }
+
+    SECTION( "GetNextRequest in v1 echoes the request's varbinds" ){
+        REQUIRE( handle(GetNextRequestPDU, SNMP_VERSION_1, allNext, 0) == SNMP_ERROR_PACKET_SENT );
+        SNMPPacket packet;
+        response(packet);
+        REQUIRE( packet.snmpVersion == SNMP_VERSION_1 );
+        REQUIRE( packet.errorStatus.errorStatus == TOO_BIG );
+        REQUIRE( packet.errorIndex.errorIndex == 0 );
+        REQUIRE( packet.varbindList.size() == allNext.size() );
+        for(size_t i = 0; i < allNext.size(); i++){
+            REQUIRE( packet.varbindList[i].oid->equals(std::make_shared<OIDType>(allNext[i])) );
+            REQUIRE( packet.varbindList[i].value->_type == NULLTYPE );
+        }
+    }
+
+    SECTION( "GetBulkRequest keeps what fits" ){
+        REQUIRE( handle(GetBulkRequestPDU, SNMP_VERSION_2C, { ".1.3.6.1.4.1.5" }, 6) == SNMP_GETBULK_OCCURRED );
+        SNMPPacket packet;
+        response(packet);
+        REQUIRE( packet.errorStatus.errorStatus == NO_ERROR );
+        REQUIRE( packet.varbindList.size() == 4 );
+        REQUIRE( packet.varbindList[3].oid->equals(callbacks[3]->OID) );
+        REQUIRE( stats.counters[SNMP_OUT_TOO_BIGS] == 0 );
+    }
+
+    SECTION( "Counted as tooBigs, not drops" ){
+        handle(GetRequestPDU, SNMP_VERSION_2C, all, 0);
+        handle(GetNextRequestPDU, SNMP_VERSION_2C, allNext, 0);
+        REQUIRE( stats.counters[SNMP_OUT_TOO_BIGS] == 2 );
+        REQUIRE( stats.counters[SNMP_OUT_GET_RESPONSES] == 2 );
+        REQUIRE( stats.counters[SNMP_SILENT_DROPS] == 0 );
+        REQUIRE( stats.counters[SNMP_IN_TOTAL_REQ_VARS] == 0 );
+    }
+}
+
 TEST_CASE( "Test GetNextRequestPDU", "[snmp]" ){
     std::deque<ValueCallback*> callbacks;
 
@@ -338,6 +641,109 @@ TEST_CASE( "sort/remove handlers ", "[snmp]"){
 
 }
 
+TEST_CASE( "Handler registry publishes snapshots", "[snmp]"){
+    SNMPHandlerRegistry registry;
+    int values[3] = {0};
+    IntegerCallback* first = new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.2"), &values[0]);
+    IntegerCallback* second = new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &values[1]);
+
+    registry.add(first);
+    registry.add(second);
+    {
+        SNMPHandlerRegistry::Reader reader(registry);
+        REQUIRE( reader.callbacks().empty() );
+    }
+
+    registry.sort();
+    {
+        SNMPHandlerRegistry::Reader reader(registry);
+        REQUIRE( reader.callbacks().size() == 2 );
+        REQUIRE( reader.callbacks()[0] == second );
+    }
+    REQUIRE_FALSE( registry.publish() );
+
+    SECTION( "Changing the registry from inside a reader refuses rather than waiting on itself"){
+        SNMPHandlerRegistry other;
+        int value = 0;
+        IntegerCallback* third = new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.3"), &value);
+        {
+            SNMPHandlerRegistry::Reader reader(registry);
+            SNMPHandlerRegistry::Reader otherReader(other);
+            registry.add(third);
+            REQUIRE_FALSE( registry.remove(first) );
+            REQUIRE_FALSE( registry.sort() );
+            REQUIRE_FALSE( registry.publish() );
+            REQUIRE( reader.callbacks().size() == 2 );
+        }
+        {
+            // Only readers of the same registry count
+            SNMPHandlerRegistry::Reader otherReader(other);
+            REQUIRE( registry.sort() );
+        }
+
+        SNMPHandlerRegistry::Reader reader(registry);
+        REQUIRE( reader.callbacks().size() == 3 );
+        REQUIRE( reader.callbacks()[2] == third );
+    }
+
+    SECTION( "A held snapshot doesn't change under the reader"){
+        SNMPHandlerRegistry::Reader* reader = new SNMPHandlerRegistry::Reader(registry);
+        const std::deque<ValueCallback*>& seen = reader->callbacks();
+
+        std::atomic<bool> removed(false);
+        std::thread writer([&](){ registry.remove(first); removed = true; });
+        // The writer can't finish while we still hold the old snapshot
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        REQUIRE_FALSE( removed );
+        REQUIRE( seen.size() == 2 );
+        REQUIRE( seen[1] == first );
+
+        delete reader;
+        writer.join();
+        REQUIRE( removed );
+
+        SNMPHandlerRegistry::Reader after(registry);
+        REQUIRE( after.callbacks().size() == 1 );
+    }
+
+    SECTION( "Readers on other threads never see a half changed list"){
+        std::atomic<bool> done(false);
+        std::atomic<int> bad(0);
+        std::vector<std::thread> readers;
+        for(int t = 0; t < 4; t++){
+            readers.push_back(std::thread([&](){
+                while(!done){
+                    SNMPHandlerRegistry::Reader reader(registry);
+                    for(auto callback : reader.callbacks()){
+                        if(!callback->OID->valid) bad++;
+                    }
+                }
+            }));
+        }
+
+        std::vector<IntegerCallback*> added;
+        for(int i = 0; i < 200; i++){
+            IntegerCallback* callback = new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.6." + std::to_string(i)), &values[2]);
+            added.push_back(callback);
+            registry.add(callback);
+            if(i % 10 == 0) registry.sort();
+        }
+        registry.sort();
+        for(auto callback : added){
+            registry.remove(callback);
+            // Nothing can still be reading it once remove() returns, so any reader that sees this has a stale snapshot
+            callback->OID->valid = false;
+        }
+
+        done = true;
+        for(auto& reader : readers) reader.join();
+        REQUIRE( bad == 0 );
+
+        SNMPHandlerRegistry::Reader reader(registry);
+        REQUIRE( reader.callbacks().size() == 2 );
+    }
+}
+
 TEST_CASE( "SNMPTraps ", "[snmp]"){
     SNMPTrap* settableNumberTrap = new SNMPTrap("public", SNMP_VERSION_1);
 
@@ -378,6 +784,126 @@ TEST_CASE( "SNMPTraps ", "[snmp]"){
 
 }
 
+// Encodes the trap's current values from scratch with the given requestID, to check patched sends against
+static std::vector<uint8_t> FullyEncodeTrap(SNMPTrap* trap, snmp_request_id_t requestID){
+    trap->buildForSending();
+    uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+    int length = trap->serialiseBuilt(buffer, MAX_SNMP_PACKET_LENGTH);
+    std::vector<uint8_t> encoded(buffer, buffer + length);
+
+    int offset = trap->encodedRequestIDOffset();
+    if(offset >= 0){
+        encoded[offset] = requestID >> 24;
+        encoded[offset + 1] = requestID >> 16;
+        encoded[offset + 2] = requestID >> 8;
+        encoded[offset + 3] = requestID;
+    }
+    return encoded;
+}
+
+// Lets a test get at the callbacks, like a subclass could
+class CallbackTrap : public SNMPTrap {
+  public:
+    using SNMPTrap::SNMPTrap;
+    using SNMPTrap::callbacks;
+};
+
+TEST_CASE( "Trap templates patch in changing values", "[snmp]"){
+    uint32_t uptime = 100;
+    int number = 5;
+    char text[16] = "abc";
+    char* textPtr = text;
+
+    for(SNMP_VERSION version : {SNMP_VERSION_1, SNMP_VERSION_2C}){
+        CallbackTrap trap("public", version);
+        trap.setInform(version == SNMP_VERSION_2C);
+        trap.setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+        trap.setUptimeCallback(new TimestampCallback(new SortableOIDType(".1.3.6.1.2.1.1.3.0"), &uptime));
+        trap.addOIDPointer(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &number));
+        trap.addOIDPointer(new StringCallback(new SortableOIDType(".1.3.6.1.4.1.5.2"), &textPtr, 16));
+
+        uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+        int length = trap.encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( length > 0 );
+        REQUIRE( (trap.encodedRequestIDOffset() >= 0) == (version == SNMP_VERSION_2C) );
+
+        // Same sized values are patched in
+        uptime = 0x12345678;
+        number = -7;
+        strcpy(text, "xyz");
+        snmp_request_id_t lastID = trap.requestID;
+        length = trap.encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( trap.requestID != lastID );
+        std::vector<uint8_t> patched(buffer, buffer + length);
+        REQUIRE( patched == FullyEncodeTrap(&trap, trap.requestID) );
+
+        // A value changing length, or the trap changing, means building it again
+        strcpy(text, "a longer one");
+        length = trap.encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( std::vector<uint8_t>(buffer, buffer + length) == FullyEncodeTrap(&trap, trap.requestID) );
+
+        trap.setSpecificTrap(4);
+        trap.setCommunityString("private");
+        length = trap.encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( std::vector<uint8_t>(buffer, buffer + length) == FullyEncodeTrap(&trap, trap.requestID) );
+
+        // Swapping a callback for another of the same size, or changing the trap OID in place, can't be patched either
+        int other = -8;
+        trap.callbacks.front() = new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.3"), &other);
+        length = trap.encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( std::vector<uint8_t>(buffer, buffer + length) == FullyEncodeTrap(&trap, trap.requestID) );
+
+        *trap.trapOID = OIDType(".1.3.6.1.2.1.33.3");
+        length = trap.encodeForSending(buffer, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( std::vector<uint8_t>(buffer, buffer + length) == FullyEncodeTrap(&trap, trap.requestID) );
+
+        REQUIRE( trap.encodeForSending(buffer, 20) <= 0 );
+        strcpy(text, "abc");
+    }
+}
+
+TEST_CASE( "Sending a trap again without building it sends what was last sent", "[snmp]"){
+    QueuedUDP udp;
+    IPAddress receiver(127, 0, 0, 1);
+    int number = 5;
+
+    SNMPTrap trap("public", SNMP_VERSION_2C);
+    trap.setInform(true);
+    trap.setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+    trap.addOIDPointer(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &number));
+    trap.setUDP(&udp);
+
+    auto parseSent = [&](SNMPPacket& packet){
+        REQUIRE( packet.parseFrom(udp.sent.back().data(), udp.sent.back().size()) == SNMP_ERROR_OK );
+    };
+
+    // The second send is patched from the first one's template, leaving the built packet behind
+    REQUIRE( trap.sendTo(receiver) );
+    number = 6;
+    REQUIRE( trap.sendTo(receiver) );
+    std::vector<uint8_t> patched = udp.sent.back();
+
+    REQUIRE( trap.sendTo(receiver, true) );
+    REQUIRE( udp.sent.back() == patched );
+    SNMPPacket resent;
+    parseSent(resent);
+    REQUIRE( resent.requestID == trap.requestID );
+
+    // Once it's built by hand, that's what gets sent
+    number = 7;
+    REQUIRE( trap.buildForSending() );
+    REQUIRE( trap.sendTo(receiver, true) );
+    SNMPPacket built;
+    parseSent(built);
+    REQUIRE( built.requestID == trap.requestID );
+    REQUIRE( udp.sent.back() != patched );
+
+    // And a trap that's never been built has nothing to send
+    SNMPTrap unbuilt("public", SNMP_VERSION_2C);
+    unbuilt.setUDP(&udp);
+    REQUIRE_FALSE( unbuilt.sendTo(receiver, true) );
+}
+
 TEST_CASE( "SNMPInform ", "[snmp]"){
     SNMPTrap* settableNumberTrap = new SNMPTrap("public", SNMP_VERSION_2C);
     settableNumberTrap->setInform(true);
@@ -414,9 +940,1053 @@ TEST_CASE( "SNMPInform ", "[snmp]"){
 
 }
 
+static SNMPTrap* GenerateTestInform(UDP* udp){
+    SNMPTrap* inform = new SNMPTrap("public", SNMP_VERSION_2C);
+    inform->setInform(true);
+    inform->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+    inform->setUDP(udp);
+    return inform;
+}
+
+TEST_CASE( "Inform queue only resends what's due", "[snmp]"){
+    QueuedUDP udp;
+    InformQueue queue;
+    IPAddress receiver(127, 0, 0, 1);
+    test_millis() = 0;
+
+    SNMPTrap* slow = GenerateTestInform(&udp);
+    SNMPTrap* fast = GenerateTestInform(&udp);
+
+    snmp_request_id_t slowID = queue_and_send_trap(queue, slow, receiver, false, 2, 100);
+    queue_and_send_trap(queue, fast, receiver, false, 1, 50);
+    REQUIRE( udp.sent.size() == 2 );
+    REQUIRE( next_inform_timeout(queue) == 51 );
+
+    test_millis() = 50;
+    handle_inform_queue(queue);
+    REQUIRE( udp.sent.size() == 2 );
+
+    // Resent once more than delay_ms has passed, same as before
+    test_millis() = 51;
+    handle_inform_queue(queue);
+    REQUIRE( udp.sent.size() == 3 );
+    REQUIRE( next_inform_timeout(queue) == 50 );
+
+    test_millis() = 101;
+    handle_inform_queue(queue);
+    REQUIRE( udp.sent.size() == 4 );
+
+    // Acknowledged informs never get resent, and don't hold up the queue
+    inform_callback(queue, slowID, true);
+    REQUIRE( next_inform_timeout(queue) == 1 );
+
+    // fast is out of retries
+    test_millis() = 102;
+    handle_inform_queue(queue);
+    REQUIRE( udp.sent.size() == 4 );
+    REQUIRE( queue.size() == 0 );
+    REQUIRE( next_inform_timeout(queue) == -1 );
+
+    SECTION( "Acknowledging by requestID, and reusing finished items"){
+        REQUIRE( queue.freeItems.size() == 2 );
+
+        std::vector<snmp_request_id_t> ids;
+        for(int i = 0; i < 50; i++){
+            ids.push_back(queue_and_send_trap(queue, i % 2 ? slow : fast, receiver, false, 1, 1000));
+        }
+        REQUIRE( queue.size() == 50 );
+        REQUIRE( queue.freeItems.empty() );
+        REQUIRE( queue.byTrap.count(slow) == 25 );
+
+        inform_callback(queue, 12345, true);
+        REQUIRE( queue.size() == 50 );
+
+        for(auto id : ids){
+            inform_callback(queue, id, true);
+        }
+        REQUIRE( queue.size() == 0 );
+        REQUIRE( queue.byTrap.empty() );
+        REQUIRE( queue.heap.empty() );
+        // Only a few kept, each with its encode buffer emptied but still there for the next Inform
+        REQUIRE( queue.freeItems.size() == SNMP_INFORM_MAX_FREE_ITEMS );
+        for(auto item : queue.freeItems){
+            REQUIRE( item->encoded.empty() );
+            REQUIRE( item->encoded.capacity() > 0 );
+        }
+        REQUIRE( queue.requestIDNodes->freeCount == SNMP_INFORM_MAX_FREE_ITEMS );
+        REQUIRE( queue.trapNodes->freeCount == SNMP_INFORM_MAX_FREE_ITEMS );
+
+        const uint8_t* reusedBuffer = queue.freeItems.back()->encoded.data();
+        queue_and_send_trap(queue, slow, receiver, false, 1, 1000);
+        REQUIRE( queue.heap.front()->encoded.data() == reusedBuffer );
+        REQUIRE( queue.requestIDNodes->freeCount == SNMP_INFORM_MAX_FREE_ITEMS - 1 );
+    }
+
+    SECTION( "Retries resend exactly what was first sent"){
+        int changing = 1;
+        slow->addOIDPointer(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.9"), &changing));
+
+        size_t firstSent = udp.sent.size();
+        snmp_request_id_t firstID = queue_and_send_trap(queue, slow, receiver, false, 1, 100);
+        changing = 2;
+        snmp_request_id_t secondID = queue_and_send_trap(queue, slow, receiver, false, 1, 200);
+        REQUIRE( firstID != secondID );
+        std::vector<uint8_t> first = udp.sent[firstSent];
+        std::vector<uint8_t> second = udp.sent[firstSent + 1];
+        REQUIRE( first != second );
+
+        // Both are still outstanding from the same trap object, each retry has to be its own packet
+        test_millis() = 102 + 101;
+        handle_inform_queue(queue);
+        REQUIRE( udp.sent.back() == first );
+
+        test_millis() = 102 + 201;
+        handle_inform_queue(queue);
+        REQUIRE( udp.sent.back() == second );
+
+        SNMPPacket parsed;
+        REQUIRE( parsed.parseFrom(udp.sent.back().data(), udp.sent.back().size()) == SNMP_ERROR_OK );
+        REQUIRE( parsed.requestID == secondID );
+    }
+
+    SECTION( "Due times still order correctly across millis() wrapping"){
+        test_millis() = (unsigned long)-10;
+        queue_and_send_trap(queue, fast, receiver, false, 1, 20);
+        REQUIRE( next_inform_timeout(queue) == 21 );
+
+        test_millis() = 5;
+        handle_inform_queue(queue);
+        REQUIRE( udp.sent.size() == 5 );
+
+        test_millis() = 11;
+        handle_inform_queue(queue);
+        REQUIRE( udp.sent.size() == 6 );
+    }
+
+    SECTION( "Replacing and deleting traps cancels their informs"){
+        queue_and_send_trap(queue, slow, receiver, false, 3, 100);
+        queue_and_send_trap(queue, slow, receiver, true, 3, 100);
+        REQUIRE( queue.size() == 1 );
+        queue_and_send_trap(queue, fast, receiver, false, 3, 10);
+        REQUIRE( queue.size() == 2 );
+
+        mark_trap_deleted(queue, fast);
+        REQUIRE( queue.size() == 1 );
+
+        test_millis() = 102 + 101;
+        handle_inform_queue(queue);
+        REQUIRE( udp.sent.size() == 8 );
+        REQUIRE( queue.size() == 1 );
+    }
+
+    test_millis() = 0;
+}
+
+TEST_CASE( "Traps fan out to many receivers from one encode", "[snmp]"){
+    QueuedUDP udp;
+    InformQueue queue;
+    std::vector<IPAddress> receivers;
+    for(int i = 1; i <= 8; i++){
+        receivers.push_back(IPAddress(10, 0, 0, i));
+    }
+
+    SNMPTrap* inform = GenerateTestInform(&udp);
+    REQUIRE( queue_and_send_trap_to_all(queue, inform, receivers, true, 1, 100) == 8 );
+    REQUIRE( udp.sent.size() == 8 );
+    REQUIRE( queue.size() == 8 );
+
+    // Everything but the requestID is shared
+    std::set<snmp_request_id_t> ids;
+    for(const auto& sent : udp.sent){
+        REQUIRE( sent.size() == udp.sent[0].size() );
+        int differing = 0;
+        for(size_t i = 0; i < sent.size(); i++){
+            differing += sent[i] != udp.sent[0][i];
+        }
+        REQUIRE( differing <= 4 );
+
+        SNMPPacket parsed;
+        REQUIRE( parsed.parseFrom((uint8_t*)sent.data(), sent.size()) == SNMP_ERROR_OK );
+        REQUIRE( parsed.packetPDUType == InformRequestPDU );
+        ids.insert(parsed.requestID);
+    }
+    REQUIRE( ids.size() == 8 );
+    REQUIRE( ids.count(inform->requestID) == 1 );
+
+    // Each receiver acknowledges its own
+    for(auto id : ids){
+        inform_callback(queue, id, true);
+    }
+    REQUIRE( queue.size() == 0 );
+
+    SECTION( "Plain traps go out identical"){
+        SNMPTrap* trap = new SNMPTrap("public", SNMP_VERSION_2C);
+        trap->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+        trap->setUDP(&udp);
+        udp.sent.clear();
+
+        REQUIRE( queue_and_send_trap_to_all(queue, trap, receivers, true, 0, 100) == 8 );
+        REQUIRE( udp.sent.size() == 8 );
+        for(const auto& sent : udp.sent){
+            REQUIRE( sent == udp.sent[0] );
+        }
+        REQUIRE( queue.size() == 0 );
+    }
+
+    SECTION( "Through the agent"){
+        SNMPAgent agent("public", "private");
+        agent.setUDP(&udp);
+        udp.sent.clear();
+
+        REQUIRE( agent.sendTrapTo(inform, receivers, true, 0) == 8 );
+        REQUIRE( udp.sent.size() == 8 );
+        REQUIRE( agent.sendTrapTo(inform, std::vector<IPAddress>()) == 0 );
+    }
+}
+
+TEST_CASE( "Queued traps are paced, prioritised and coalesced", "[snmp]"){
+    QueuedUDP udp;
+    SNMPAgent agent("public", "private");
+    IPAddress receiver(10, 0, 0, 1);
+    test_millis() = 1000;
+
+    std::vector<SNMPTrap*> traps;
+    for(int i = 0; i < 6; i++){
+        SNMPTrap* trap = new SNMPTrap("public", SNMP_VERSION_2C);
+        // v2c traps don't carry the specific trap, so each gets its own trap OID to tell them apart on the wire
+        trap->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2." + std::to_string(i)));
+        trap->setSpecificTrap(i);
+        trap->setUDP(&udp);
+        traps.push_back(trap);
+    }
+
+    // 10 a second, 2 at once
+    agent.setTrapRateLimit(10, 2);
+    for(int i = 0; i < 4; i++){
+        REQUIRE( agent.queueTrap(traps[i], receiver) );
+    }
+    REQUIRE( agent.queuedTraps() == 4 );
+    REQUIRE( udp.sent.empty() );
+
+    agent.loop();
+    REQUIRE( udp.sent.size() == 2 );
+    REQUIRE( agent.queuedTraps() == 2 );
+    REQUIRE( agent.nextInformTimeout() == 100 );
+
+    test_millis() = 1050;
+    agent.loop();
+    REQUIRE( udp.sent.size() == 2 );
+
+    test_millis() = 1100;
+    agent.onTimer();
+    REQUIRE( udp.sent.size() == 3 );
+
+    SECTION( "Repeats of a waiting trap are folded into it"){
+        REQUIRE( agent.queueTrap(traps[3], receiver) );
+        REQUIRE( agent.queueTrap(traps[3], IPAddress(10, 0, 0, 2)) );
+        REQUIRE( agent.queuedTraps() == 1 );
+        REQUIRE( agent.getTrapQueueStats().coalesced == 2 );
+
+        // Only one token for its two receivers, the second goes once there's another
+        test_millis() = 1200;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 4 );
+        REQUIRE( agent.queuedTraps() == 1 );
+        test_millis() = 1300;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 5 );
+        REQUIRE( agent.queuedTraps() == 0 );
+        REQUIRE( agent.getTrapQueueStats().sent == 5 );
+        REQUIRE( agent.nextInformTimeout() == -1 );
+    }
+
+    SECTION( "Higher priorities go first, and push out lower ones when full"){
+        auto sentTrap = [&](size_t index) -> std::string {
+            SNMPPacket parsed;
+            REQUIRE( parsed.parseFrom(udp.sent[index].data(), udp.sent[index].size()) == SNMP_ERROR_OK );
+            REQUIRE( parsed.varbindList.size() >= 2 );
+            return std::static_pointer_cast<OIDType>(parsed.varbindList[1].value)->string();
+        };
+
+        agent.setTrapQueueLength(3);
+        REQUIRE( agent.queueTrap(traps[4], receiver, SNMP_TRAP_PRIORITY_LOW) );
+        REQUIRE( agent.queueTrap(traps[5], receiver, SNMP_TRAP_PRIORITY_HIGH) );
+        REQUIRE( agent.queuedTraps() == 3 );
+
+        // traps[3] is still waiting at normal priority
+        test_millis() = 2000;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 5 );
+        REQUIRE( sentTrap(3) == ".1.3.6.1.2.1.33.2.5" );
+        REQUIRE( sentTrap(4) == ".1.3.6.1.2.1.33.2.3" );
+        test_millis() = 2100;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 6 );
+        REQUIRE( sentTrap(5) == ".1.3.6.1.2.1.33.2.4" );
+        REQUIRE( agent.queuedTraps() == 0 );
+
+        REQUIRE( agent.queueTrap(traps[1], receiver, SNMP_TRAP_PRIORITY_LOW) );
+        REQUIRE( agent.queueTrap(traps[2], receiver, SNMP_TRAP_PRIORITY_LOW) );
+        REQUIRE( agent.queueTrap(traps[3], receiver) );
+        REQUIRE( agent.queueTrap(traps[0], receiver, SNMP_TRAP_PRIORITY_HIGH) );
+        REQUIRE( agent.queuedTraps() == 3 );
+        REQUIRE( agent.getTrapQueueStats().dropped == 1 );
+        REQUIRE_FALSE( agent.queueTrap(traps[4], receiver, SNMP_TRAP_PRIORITY_LOW) );
+        REQUIRE( agent.getTrapQueueStats().dropped == 2 );
+
+        // Raising a waiting trap's priority moves it up, behind what was already there
+        REQUIRE( agent.queueTrap(traps[2], receiver, SNMP_TRAP_PRIORITY_HIGH) );
+
+        test_millis() = 3000;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 8 );
+        REQUIRE( sentTrap(6) == ".1.3.6.1.2.1.33.2.0" );
+        REQUIRE( sentTrap(7) == ".1.3.6.1.2.1.33.2.2" );
+        test_millis() = 3100;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 9 );
+        REQUIRE( sentTrap(8) == ".1.3.6.1.2.1.33.2.3" );
+        // traps[1], the oldest low priority one, was pushed out
+        REQUIRE( agent.queuedTraps() == 0 );
+
+        // Deleted traps never get sent
+        TrapQueue queue;
+        trap_queue_push(queue, traps[3], std::vector<IPAddress>(1, receiver), SNMP_TRAP_PRIORITY_HIGH, true, 0, 100);
+        trap_queue_remove(queue, traps[3]);
+        REQUIRE( queue.size() == 0 );
+        REQUIRE( trap_queue_front(queue) == nullptr );
+    }
+
+    SECTION( "A trap with no receivers isn't queued to block the rest"){
+        REQUIRE_FALSE( agent.queueTrap(traps[4], std::vector<IPAddress>()) );
+        REQUIRE_FALSE( agent.queueTrap(traps[3], std::vector<IPAddress>(), SNMP_TRAP_PRIORITY_HIGH) );
+        REQUIRE( agent.queuedTraps() == 1 );
+        REQUIRE( agent.getTrapQueueStats().dropped == 0 );
+
+        test_millis() = 1200;
+        agent.loop();
+        REQUIRE( udp.sent.size() == 4 );
+        REQUIRE( agent.queuedTraps() == 0 );
+        REQUIRE( agent.nextInformTimeout() == -1 );
+    }
+
+    SECTION( "Without a limit everything goes on the next loop"){
+        agent.setTrapRateLimit(0);
+        agent.loop();
+        REQUIRE( udp.sent.size() == 4 );
+        REQUIRE( agent.nextInformTimeout() == -1 );
+    }
+
+    for(auto trap : traps) delete trap;
+    test_millis() = 0;
+}
+
 TEST_CASE( "Test OID Validation ", "[snmp]"){
     REQUIRE( (new OIDType(".1.3.6.1.4.1.52420"))->valid );
     REQUIRE( (new OIDType(".1.3.6.1.4.1.52420."))->valid );
     REQUIRE( (new OIDType("1.3.6.1.4.1.52420"))->valid == false );
     REQUIRE( (new OIDType(".1.3.6.1.4.1..52420"))->valid == false );
 }
+
+TEST_CASE( "Malformed lengths are rejected", "[snmp]"){
+    // Long form length saying more than we were given
+    uint8_t tooLong[] = { 0x30, 0x82, 0x01, 0x00, 0x04, 0x01, 'a' };
+    ComplexType structure(STRUCTURE);
+    REQUIRE( structure.fromBuffer(tooLong, sizeof(tooLong)) == SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED );
+
+    // Length bytes padded with leading zeros are still fine, as long as what they add up to fits
+    uint8_t padded[] = { 0x30, 0x84, 0x00, 0x00, 0x00, 0x03, 0x04, 0x01, 'a' };
+    ASN_TYPE type;
+    size_t length;
+    REQUIRE( decode_ber_header(padded, sizeof(padded), &type, &length) == 6 );
+    REQUIRE( type == STRUCTURE );
+    REQUIRE( length == 3 );
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(padded, sizeof(padded)) == (int)sizeof(padded) );
+
+    uint8_t paddedTooLong[] = { 0x30, 0x84, 0x00, 0x00, 0x00, 0x30, 0x04, 0x01, 'a' };
+    REQUIRE( decode_ber_header(paddedTooLong, sizeof(paddedTooLong), &type, &length) == SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED );
+    // Big enough to wrap around if it were added to the header length
+    uint8_t hugeLength[] = { 0x30, 0x88, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x04, 0x01, 'a' };
+    REQUIRE( decode_ber_header(hugeLength, sizeof(hugeLength), &type, &length) == SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED );
+    uint8_t tooManyLengthBytes[] = { 0x30, 0x89, 0, 0, 0, 0, 0, 0, 0, 0, 0x03, 0x04, 0x01, 'a' };
+    REQUIRE( decode_ber_header(tooManyLengthBytes, sizeof(tooManyLengthBytes), &type, &length) == SNMP_BUFFER_ERROR_MAX_LEN_EXCEEDED );
+
+    // Values whose length their type can't have
+    uint8_t shortAddress[] = { 0x30, 0x05, 0x40, 0x03, 192, 168, 1 };
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(shortAddress, sizeof(shortAddress)) == SNMP_BUFFER_ERROR_PROBLEM_DESERIALISING );
+    uint8_t longInteger[] = { 0x30, 0x08, 0x02, 0x06, 0, 0, 0, 0, 0, 1 };
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(longInteger, sizeof(longInteger)) == SNMP_BUFFER_ERROR_PROBLEM_DESERIALISING );
+
+    // A 5th integer byte is only there to keep an unsigned value's top bit clear, so it has to be 0
+    uint8_t fullCounter[] = { 0x30, 0x07, 0x41, 0x05, 0x00, 0xFF, 0xFF, 0xFF, 0xFF };
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(fullCounter, sizeof(fullCounter)) == (int)sizeof(fullCounter) );
+    uint8_t overflowingCounter[] = { 0x30, 0x07, 0x41, 0x05, 0x01, 0x00, 0x00, 0x00, 0x00 };
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(overflowingCounter, sizeof(overflowingCounter)) == SNMP_BUFFER_ERROR_PROBLEM_DESERIALISING );
+
+    // A child claiming more than its parent has left, even though the buffer has it
+    uint8_t overrun[] = { 0x30, 0x03, 0x04, 0x05, 'a', 'b', 'c', 'd', 'e' };
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(overrun, sizeof(overrun)) == SNMP_BUFFER_ERROR_PROBLEM_DESERIALISING );
+
+    // Version and community but no PDU
+    uint8_t noPDU[] = { 0x30, 0x0b, 0x02, 0x01, 0x01, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c' };
+    SNMPPacket packet;
+    REQUIRE( packet.parseFrom(noPDU, sizeof(noPDU)) == SNMP_PARSE_ERROR_AT_STATE(PDU) );
+}
+
+TEST_CASE( "Nesting is limited to SNMP_MAX_DECODE_DEPTH", "[snmp]"){
+    // depth structures, each the only thing in the last, with a null in the middle
+    auto nested = [](int depth){
+        std::vector<uint8_t> buffer = { NULLTYPE, 0 };
+        for(int i = 0; i < depth; i++){
+            buffer.insert(buffer.begin(), { STRUCTURE, (uint8_t)buffer.size() });
+        }
+        return buffer;
+    };
+
+    auto deepest = nested(SNMP_MAX_DECODE_DEPTH);
+    ComplexType allowed(STRUCTURE);
+    REQUIRE( allowed.fromBuffer(deepest.data(), deepest.size()) == (int)deepest.size() );
+    BER_CONTAINER* value = &allowed;
+    for(int i = 0; i < SNMP_MAX_DECODE_DEPTH; i++){
+        REQUIRE( static_cast<ComplexType*>(value)->values.size() == 1 );
+        value = static_cast<ComplexType*>(value)->values[0].get();
+    }
+    REQUIRE( value->_type == NULLTYPE );
+
+    auto tooDeep = nested(SNMP_MAX_DECODE_DEPTH + 1);
+    REQUIRE( ComplexType(STRUCTURE).fromBuffer(tooDeep.data(), tooDeep.size()) == SNMP_BUFFER_ERROR_TOO_DEEP );
+
+    // Far deeper than anything would ever send, still refused the same way
+    auto malicious = nested(60);
+    SNMPPacket packet;
+    REQUIRE( packet.parseFrom(malicious.data(), malicious.size()) == SNMP_BUFFER_ERROR_TOO_DEEP );
+}
+
+TEST_CASE( "Allocations are counted per request type and phase", "[snmp]"){
+    std::deque<ValueCallback*> callbacks;
+    int value = 5;
+    callbacks.push_back(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.1"), &value));
+    callbacks.push_back(new IntegerCallback(new SortableOIDType(".1.3.6.1.4.1.5.2"), &value));
+
+    auto handle = [&](ASN_TYPE pduType){
+        SNMPPacket request;
+        SetupTestSNMPRequest(request, pduType, SNMP_VERSION_2C, "public", 1234, {".1.3.6.1.4.1.5.1"});
+        uint8_t buffer[MAX_SNMP_PACKET_LENGTH];
+        int length = request.serialiseInto(buffer, MAX_SNMP_PACKET_LENGTH);
+        int responseLength = 0;
+        return handlePacket(buffer, length, &responseLength, MAX_SNMP_PACKET_LENGTH, callbacks, "private", "public");
+    };
+
+    snmp_alloc_stats_reset();
+    REQUIRE( handle(GetRequestPDU) == SNMP_GET_OCCURRED );
+    REQUIRE( handle(GetNextRequestPDU) == SNMP_GETNEXT_OCCURRED );
+    REQUIRE( handle(GetNextRequestPDU) == SNMP_GETNEXT_OCCURRED );
+
+    SNMPAllocStats& stats = snmp_alloc_stats();
+    REQUIRE( stats.requests[GetRequestPDU - ASN_PDU_TYPE_MIN_VALUE] == 1 );
+    REQUIRE( stats.requests[GetNextRequestPDU - ASN_PDU_TYPE_MIN_VALUE] == 2 );
+    REQUIRE( stats.requests[SetRequestPDU - ASN_PDU_TYPE_MIN_VALUE] == 0 );
+
+#ifdef SNMP_ALLOC_STATS
+    // Plain GETs are answered in place, GETNEXT still decodes into objects
+    REQUIRE( stats.pduTypes[GetRequestPDU - ASN_PDU_TYPE_MIN_VALUE].allocations == 0 );
+    REQUIRE( stats.pduTypes[GetNextRequestPDU - ASN_PDU_TYPE_MIN_VALUE].allocations > 0 );
+    REQUIRE( stats.phases[SNMP_ALLOC_DECODE].allocations > 0 );
+    REQUIRE( stats.phases[SNMP_ALLOC_DECODE].bytes > 0 );
+#endif
+
+    snmp_alloc_stats_reset();
+    REQUIRE( stats.requests[GetNextRequestPDU - ASN_PDU_TYPE_MIN_VALUE] == 0 );
+}
+
+TEST_CASE( "Queueing and acknowledging Informs doesn't allocate once warm", "[snmp]"){
+    // The stub's sends go nowhere, so anything counted is the queue's own
+    UDP udp;
+    InformQueue queue;
+    IPAddress receiver(127, 0, 0, 1);
+    SNMPTrap* inform = GenerateTestInform(&udp);
+
+    // As many outstanding at once as the queue keeps items for, all sent before any are acknowledged
+    std::vector<snmp_request_id_t> requestIDs;
+    requestIDs.reserve(SNMP_INFORM_MAX_FREE_ITEMS);
+    auto cycle = [&](){
+        for(int i = 0; i < SNMP_INFORM_MAX_FREE_ITEMS; i++){
+            requestIDs.push_back(queue_and_send_trap(queue, inform, receiver, false, 1, 1000));
+        }
+        for(auto requestID : requestIDs){
+            inform_callback(queue, requestID, true);
+        }
+        requestIDs.clear();
+    };
+
+    // The first one builds the trap's template and fills the queue's pools
+    cycle();
+    snmp_alloc_stats_reset();
+    for(int i = 0; i < 5; i++) cycle();
+    // Read before any REQUIRE, reporting one can allocate
+    unsigned long allocations = snmp_alloc_stats().phases[SNMP_ALLOC_OUTSIDE].allocations;
+
+    REQUIRE( queue.size() == 0 );
+    REQUIRE( queue.freeItems.size() == SNMP_INFORM_MAX_FREE_ITEMS );
+#ifdef SNMP_ALLOC_STATS
+    REQUIRE( allocations == 0 );
+#else
+    (void)allocations;
+#endif
+    delete inform;
+}
+
+TEST_CASE( "Latency histograms", "[snmp]"){
+    SNMPLatencyHistogram histogram;
+    REQUIRE( histogram.percentile(50) == 0 );
+
+    for(int i = 0; i < 90; i++) histogram.record(3);
+    for(int i = 0; i < 9; i++) histogram.record(150);
+    histogram.record(7000);
+
+    REQUIRE( histogram.count == 100 );
+    REQUIRE( histogram.max == 7000 );
+    REQUIRE( histogram.buckets[2] == 90 );
+    REQUIRE( histogram.percentile(50) == 5 );
+    REQUIRE( histogram.percentile(90) == 5 );
+    REQUIRE( histogram.percentile(99) == 200 );
+    REQUIRE( histogram.percentile(100) == 7000 );
+
+    histogram.record(0xffffffff);
+    REQUIRE( histogram.buckets[SNMP_LATENCY_BUCKETS - 1] == 1 );
+
+    SECTION( "The agent times its requests and serves the results"){
+        SNMPAgent agent("public", "private");
+        int value = 5;
+        agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value);
+        REQUIRE( agent.addLatencyHandlers(".1.3.6.1.4.1.5.99") );
+        agent.sortHandlers();
+
+        QueuedUDP udp;
+        agent.setUDP(&udp);
+
+        SNMPPacket request;
+        SetupTestSNMPRequest(request, GetNextRequestPDU, SNMP_VERSION_2C, "public", 1, {".1.3.6.1.4.1.5.1"});
+        for(int i = 0; i < 4; i++) udp.queueRequest(&request);
+        agent.loop(10);
+
+        const SNMPAgentStats& stats = agent.getStats();
+        for(int phase = 0; phase < SNMP_LATENCY_PHASE_COUNT; phase++){
+            REQUIRE( stats.latency[phase].count == 4 );
+        }
+
+        // Total requests so far, read back through the agent
+        SNMPPacket countRequest;
+        SetupTestSNMPRequest(countRequest, GetRequestPDU, SNMP_VERSION_2C, "public", 2, {".1.3.6.1.4.1.5.99.6.1", ".1.3.6.1.4.1.5.99.6.4"});
+        udp.queueRequest(&countRequest);
+        agent.loop(10);
+
+        SNMPPacket response;
+        REQUIRE( response.parseFrom(udp.sent.back().data(), udp.sent.back().size()) == SNMP_ERROR_OK );
+        REQUIRE( response.varbindList.size() == 2 );
+        REQUIRE( response.varbindList[0].value->_type == COUNTER32 );
+        REQUIRE( std::static_pointer_cast<Counter32>(response.varbindList[0].value)->_value == 4 );
+        REQUIRE( response.varbindList[1].value->_type == GAUGE32 );
+    }
+}
+
+TEST_CASE( "snmp group counters", "[snmp]"){
+    SNMPAgent agent("public", "private");
+    int value = 5;
+    agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value, true);
+    agent.addReadOnlyIntegerHandler(".1.3.6.1.4.1.5.2", 7);
+    REQUIRE( agent.addSNMPGroupHandlers() );
+    agent.sortHandlers();
+
+    QueuedUDP udp;
+    agent.setUDP(&udp);
+
+    auto queueRequest = [&udp](ASN_TYPE type, const char* community, const std::vector<std::string>& oids){
+        SNMPPacket request;
+        SetupTestSNMPRequest(request, type, SNMP_VERSION_2C, community, 1, type == SetRequestPDU ? std::vector<std::string>() : oids);
+        if(type == SetRequestPDU){
+            for(const std::string& oid : oids){
+                request.varbindList.push_back(VarBind(std::make_shared<OIDType>(oid), std::make_shared<IntegerType>(6)));
+            }
+        }
+        udp.queueRequest(&request);
+    };
+
+    queueRequest(GetRequestPDU, "public", {".1.3.6.1.4.1.5.1"});
+    queueRequest(GetRequestPDU, "public", {".1.3.6.1.4.1.5.1"});
+    queueRequest(GetNextRequestPDU, "public", {".1.3.6.1.4.1.5.1"});
+    queueRequest(SetRequestPDU, "private", {".1.3.6.1.4.1.5.1"});
+    queueRequest(SetRequestPDU, "public", {".1.3.6.1.4.1.5.1"});
+    queueRequest(GetRequestPDU, "wrong", {".1.3.6.1.4.1.5.1"});
+    queueRequest(SetRequestPDU, "private", {".1.3.6.1.4.1.5.2"});
+    udp.received.push_back(std::vector<uint8_t>(10, 0xff));
+    udp.received.push_back(std::vector<uint8_t>(MAX_SNMP_PACKET_LENGTH + 1, 0x30));
+    agent.loop(50);
+
+    const uint32_t* counters = agent.getStats().counters;
+    REQUIRE( counters[SNMP_IN_PKTS] == 9 );
+    REQUIRE( counters[SNMP_OUT_PKTS] == 6 );
+    REQUIRE( counters[SNMP_OUT_GET_RESPONSES] == 6 );
+    REQUIRE( counters[SNMP_IN_GET_REQUESTS] == 2 );
+    REQUIRE( counters[SNMP_IN_GET_NEXTS] == 1 );
+    REQUIRE( counters[SNMP_IN_SET_REQUESTS] == 3 );
+    REQUIRE( counters[SNMP_IN_TOTAL_REQ_VARS] == 3 );
+    REQUIRE( counters[SNMP_IN_TOTAL_SET_VARS] == 1 );
+    REQUIRE( counters[SNMP_IN_BAD_COMMUNITY_NAMES] == 1 );
+    REQUIRE( counters[SNMP_IN_BAD_COMMUNITY_USES] == 1 );
+    REQUIRE( counters[SNMP_IN_ASN_PARSE_ERRS] == 2 );
+
+    SECTION( "Served under 1.3.6.1.2.1.11"){
+        queueRequest(GetRequestPDU, "public", {".1.3.6.1.2.1.11.1.0", ".1.3.6.1.2.1.11.4.0", ".1.3.6.1.2.1.11.30.0"});
+        agent.loop(10);
+
+        SNMPPacket response;
+        REQUIRE( response.parseFrom(udp.sent.back().data(), udp.sent.back().size()) == SNMP_ERROR_OK );
+        REQUIRE( response.varbindList.size() == 3 );
+        REQUIRE( response.varbindList[0].value->_type == COUNTER32 );
+        REQUIRE( std::static_pointer_cast<Counter32>(response.varbindList[0].value)->_value == 10 );
+        REQUIRE( std::static_pointer_cast<Counter32>(response.varbindList[1].value)->_value == 1 );
+        REQUIRE( std::static_pointer_cast<IntegerType>(response.varbindList[2].value)->_value == 2 );
+    }
+}
+
+TEST_CASE( "SNMPAgent loop drains waiting packets", "[snmp]"){
+    SNMPAgent agent("public", "private");
+    int value = 5;
+    agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value);
+    agent.sortHandlers();
+
+    QueuedUDP first, second;
+    agent.setUDP(&first);
+    agent.setUDP(&second);
+
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 1, {".1.3.6.1.4.1.5.1"});
+
+    for(int i = 0; i < 3; i++) first.queueRequest(&request);
+    for(int i = 0; i < 2; i++) second.queueRequest(&request);
+    first.received.push_back(std::vector<uint8_t>(10, 0xff));
+
+    SECTION( "Everything waiting is handled in one call"){
+        SNMPLoopResult result = agent.loop(50);
+        REQUIRE( result.packets == 6 );
+        REQUIRE( result.responses == 5 );
+        REQUIRE( result.errors == 1 );
+        REQUIRE_FALSE( result.budgetExhausted );
+        REQUIRE( first.sent.size() == 3 );
+        REQUIRE( second.sent.size() == 2 );
+
+        REQUIRE( agent.loop(50).packets == 0 );
+    }
+
+    SECTION( "Stops once maxPackets have been handled"){
+        SNMPLoopResult result = agent.loop(3);
+        REQUIRE( result.packets == 3 );
+        REQUIRE( result.budgetExhausted );
+        REQUIRE( first.sent.size() == 2 );
+        REQUIRE( second.sent.size() == 1 );
+
+        result = agent.loop(10);
+        REQUIRE( result.packets == 3 );
+        REQUIRE_FALSE( result.budgetExhausted );
+    }
+
+    SECTION( "Stops once the time budget has passed"){
+        // Every read of millis() moves it on 2ms, so a 5ms budget runs out after a couple of packets
+        test_millis() = 500;
+        test_millis_step() = 2;
+        SNMPLoopResult result = agent.loop(50, 5);
+        test_millis_step() = 0;
+
+        REQUIRE( result.budgetExhausted );
+        REQUIRE( result.packets > 0 );
+        REQUIRE( result.packets < 6 );
+        REQUIRE( first.sent.size() + second.sent.size() == (size_t)result.responses );
+
+        // Whatever's left is still there for the next call
+        result = agent.loop(50);
+        REQUIRE_FALSE( result.budgetExhausted );
+        REQUIRE( first.sent.size() + second.sent.size() == 5 );
+        test_millis() = 0;
+    }
+
+    SECTION( "Single packet loop takes turns between sockets"){
+        REQUIRE( agent.loop() == SNMP_GET_OCCURRED );
+        REQUIRE( first.sent.size() == 1 );
+        REQUIRE( second.sent.size() == 0 );
+
+        REQUIRE( agent.loop() == SNMP_GET_OCCURRED );
+        REQUIRE( first.sent.size() == 1 );
+        REQUIRE( second.sent.size() == 1 );
+
+        REQUIRE( agent.loop() == SNMP_GET_OCCURRED );
+        REQUIRE( agent.loop() == SNMP_GET_OCCURRED );
+        REQUIRE( first.sent.size() == 2 );
+        REQUIRE( second.sent.size() == 2 );
+    }
+
+    SECTION( "Counts are kept per socket"){
+        agent.loop(50);
+
+        const SNMPSocketStats* firstStats = agent.getSocketStats(&first);
+        REQUIRE( firstStats );
+        REQUIRE( firstStats->received == 4 );
+        REQUIRE( firstStats->sent == 3 );
+        REQUIRE( firstStats->dropped == 1 );
+
+        const SNMPSocketStats* secondStats = agent.getSocketStats(&second);
+        REQUIRE( secondStats );
+        REQUIRE( secondStats->received == 2 );
+        REQUIRE( secondStats->sent == 2 );
+        REQUIRE( secondStats->dropped == 0 );
+
+        QueuedUDP unknown;
+        REQUIRE( agent.getSocketStats(&unknown) == nullptr );
+    }
+}
+
+#ifdef SNMP_LINUX_UDP
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+TEST_CASE( "LinuxUDP answers a batch of requests", "[snmp]"){
+    SNMPAgent agent("public", "private");
+    int value = 5;
+    agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value);
+    agent.sortHandlers();
+
+    // Any free port will do, it's only ever talked to over loopback
+    LinuxUDP udp(8);
+    agent.setUDPport(0);
+    agent.setUDP(&udp);
+    REQUIRE( udp.fd() >= 0 );
+    REQUIRE( udp.localPort() > 0 );
+
+    int client = socket(AF_INET, SOCK_DGRAM, 0);
+    REQUIRE( client >= 0 );
+    struct sockaddr_in agentAddress;
+    memset(&agentAddress, 0, sizeof(agentAddress));
+    agentAddress.sin_family = AF_INET;
+    agentAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    agentAddress.sin_port = htons(udp.localPort());
+
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 1, {".1.3.6.1.4.1.5.1"});
+
+    // More than one batch's worth, so it has to go back to the kernel partway through
+    const int requests = 12;
+    for(int i = 0; i < requests; i++){
+        uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+        request.setRequestID(100 + i);
+        int length = request.serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( sendto(client, buf, length, 0, (struct sockaddr*)&agentAddress, sizeof(agentAddress)) == length );
+    }
+
+    REQUIRE( udp.waitForPacket(1000) );
+    SNMPLoopResult result = agent.loop(50);
+    REQUIRE( result.packets == requests );
+    REQUIRE( result.responses == requests );
+    // Only counted once they've actually been sent
+    REQUIRE( udp.datagramsSent() == (unsigned long)requests );
+    REQUIRE( agent.getSocketStats(&udp)->sent == requests );
+    REQUIRE( agent.getSocketStats(&udp)->dropped == 0 );
+
+    for(int i = 0; i < requests; i++){
+        struct pollfd pfd = { client, POLLIN, 0 };
+        REQUIRE( poll(&pfd, 1, 1000) == 1 );
+
+        uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+        int length = recv(client, buf, sizeof(buf), 0);
+        REQUIRE( length > 0 );
+
+        SNMPPacket response;
+        REQUIRE( response.parseFrom(buf, length) == SNMP_ERROR_OK );
+        REQUIRE( response.packetPDUType == GetResponsePDU );
+        REQUIRE( response.requestID == (snmp_request_id_t)(100 + i) );
+    }
+
+    close(client);
+}
+TEST_CASE( "SNMPWorkerPool answers requests across its workers", "[snmp]"){
+    SNMPAgent agent("public", "private");
+    int value = 5;
+    agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value, true);
+    agent.sortHandlers();
+
+    SNMPWorkerPool pool(agent, 4, 8);
+    REQUIRE( pool.start(0) );
+    REQUIRE( pool.isRunning() );
+    REQUIRE( pool.port() > 0 );
+
+    struct sockaddr_in agentAddress;
+    memset(&agentAddress, 0, sizeof(agentAddress));
+    agentAddress.sin_family = AF_INET;
+    agentAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    agentAddress.sin_port = htons(pool.port());
+
+    // Different source ports, so the kernel has something to spread across the workers
+    const int clients = 8;
+    const int requestsPerClient = 10;
+    int sockets[clients];
+
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 1, {".1.3.6.1.4.1.5.1"});
+
+    for(int c = 0; c < clients; c++){
+        sockets[c] = socket(AF_INET, SOCK_DGRAM, 0);
+        REQUIRE( sockets[c] >= 0 );
+        for(int i = 0; i < requestsPerClient; i++){
+            uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+            request.setRequestID(1000 * c + i + 1);
+            int length = request.serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+            REQUIRE( sendto(sockets[c], buf, length, 0, (struct sockaddr*)&agentAddress, sizeof(agentAddress)) == length );
+        }
+    }
+
+    for(int c = 0; c < clients; c++){
+        for(int i = 0; i < requestsPerClient; i++){
+            struct pollfd pfd = { sockets[c], POLLIN, 0 };
+            REQUIRE( poll(&pfd, 1, 1000) == 1 );
+
+            uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+            int length = recv(sockets[c], buf, sizeof(buf), 0);
+
+            SNMPPacket response;
+            REQUIRE( response.parseFrom(buf, length) == SNMP_ERROR_OK );
+            REQUIRE( response.packetPDUType == GetResponsePDU );
+            REQUIRE( response.requestID / 1000 == (snmp_request_id_t)c );
+        }
+    }
+
+    SECTION( "Sets go through too"){
+        SNMPPacket set;
+        SetupTestSNMPRequest(set, SetRequestPDU, SNMP_VERSION_2C, "private", 5);
+        set.varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.1"), std::make_shared<IntegerType>(42)));
+
+        uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+        int length = set.serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+        REQUIRE( sendto(sockets[0], buf, length, 0, (struct sockaddr*)&agentAddress, sizeof(agentAddress)) == length );
+
+        struct pollfd pfd = { sockets[0], POLLIN, 0 };
+        REQUIRE( poll(&pfd, 1, 1000) == 1 );
+        REQUIRE( recv(sockets[0], buf, sizeof(buf), 0) > 0 );
+
+        REQUIRE( value == 42 );
+        REQUIRE( agent.setOccurred );
+    }
+
+    REQUIRE( pool.getStats().received >= clients * requestsPerClient );
+
+    pool.stop();
+    REQUIRE_FALSE( pool.isRunning() );
+
+    for(int c = 0; c < clients; c++){
+        close(sockets[c]);
+    }
+}
+TEST_CASE( "Inform responses taken by a worker pool are matched on the agent's thread", "[snmp]"){
+    SNMPAgent agent("public", "private");
+    int value = 5;
+    agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value, true);
+    agent.sortHandlers();
+
+    QueuedUDP informs;
+    SNMPTrap* inform = new SNMPTrap("public", SNMP_VERSION_2C);
+    inform->setInform(true);
+    inform->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+    inform->setUDP(&informs);
+
+    SNMPWorkerPool pool(agent, 4, 8);
+    REQUIRE( pool.start(0) );
+
+    struct sockaddr_in agentAddress;
+    memset(&agentAddress, 0, sizeof(agentAddress));
+    agentAddress.sin_family = AF_INET;
+    agentAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    agentAddress.sin_port = htons(pool.port());
+
+    // Each receiver's inform has its own requestID, read back out of what was sent
+    const int receivers = 64;
+    test_millis() = 0;
+    REQUIRE( agent.sendTrapTo(inform, std::vector<IPAddress>(receivers, IPAddress(127, 0, 0, 1)), false, 1000, 50) == receivers );
+    std::vector<snmp_request_id_t> requestIDs;
+    for(auto& sent : informs.sent){
+        SNMPPacket parsed;
+        REQUIRE( parsed.parseFrom(sent.data(), sent.size()) == SNMP_ERROR_OK );
+        requestIDs.push_back(parsed.requestID);
+    }
+    REQUIRE( requestIDs.size() == receivers );
+
+    SNMPPacket set;
+    SetupTestSNMPRequest(set, SetRequestPDU, SNMP_VERSION_2C, "private", 1);
+    set.varbindList.push_back(VarBind(std::make_shared<OIDType>(".1.3.6.1.4.1.5.1"), std::make_shared<IntegerType>(42)));
+
+    // Managers acknowledge them (and set something) through the pool's workers, while the agent's own thread
+    // keeps resending and reading setOccurred. Run under SNMP_TSAN to have any race between them reported
+    std::thread managers([&](){
+        int client = socket(AF_INET, SOCK_DGRAM, 0);
+        uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+        for(auto requestID : requestIDs){
+            SNMPPacket response;
+            SetupTestSNMPRequest(response, GetResponsePDU, SNMP_VERSION_2C, "public", requestID);
+            int length = response.serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+            sendto(client, buf, length, 0, (struct sockaddr*)&agentAddress, sizeof(agentAddress));
+        }
+        int length = set.serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+        sendto(client, buf, length, 0, (struct sockaddr*)&agentAddress, sizeof(agentAddress));
+        close(client);
+    });
+
+    test_millis_step() = 1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while((agent.nextInformTimeout() != -1 || !agent.setOccurred) && std::chrono::steady_clock::now() < deadline){
+        agent.onTimer();
+        std::this_thread::yield();
+    }
+    test_millis_step() = 0;
+    managers.join();
+    pool.stop();
+
+    REQUIRE( agent.nextInformTimeout() == -1 );
+    REQUIRE( agent.setOccurred );
+    REQUIRE( value == 42 );
+
+    delete inform;
+    test_millis() = 0;
+}
+TEST_CASE( "SNMPAgent can be driven from epoll", "[snmp]"){
+    SNMPAgent agent("public", "private");
+    int value = 5;
+    agent.addIntegerHandler(".1.3.6.1.4.1.5.1", &value);
+
+    LinuxUDP udp;
+    QueuedUDP polled;
+    agent.setUDPport(0);
+    agent.setUDP(&udp);
+    agent.setUDP(&polled);
+    // Every setUDP() rebinds, so only ask once they're all added
+    REQUIRE( udp.localPort() > 0 );
+
+    // Only the Linux sockets have something to watch
+    std::vector<int> fds = agent.getFileDescriptors();
+    REQUIRE( fds.size() == 1 );
+    REQUIRE( fds[0] == udp.fd() );
+
+    int epfd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = fds[0];
+    REQUIRE( epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event) == 0 );
+
+    int client = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in agentAddress;
+    memset(&agentAddress, 0, sizeof(agentAddress));
+    agentAddress.sin_family = AF_INET;
+    agentAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    agentAddress.sin_port = htons(udp.localPort());
+
+    SNMPPacket request;
+    SetupTestSNMPRequest(request, GetRequestPDU, SNMP_VERSION_2C, "public", 7, {".1.3.6.1.4.1.5.1"});
+
+    uint8_t buf[MAX_SNMP_PACKET_LENGTH];
+    int length = request.serialiseInto(buf, MAX_SNMP_PACKET_LENGTH);
+    for(int i = 0; i < 3; i++){
+        REQUIRE( sendto(client, buf, length, 0, (struct sockaddr*)&agentAddress, sizeof(agentAddress)) == length );
+    }
+
+    struct epoll_event ready;
+    REQUIRE( epoll_wait(epfd, &ready, 1, 1000) == 1 );
+
+    // Edge triggered, so everything has to be handled in one go
+    SNMPLoopResult result = agent.onReadable(ready.data.fd);
+    REQUIRE( result.packets == 3 );
+    REQUIRE( result.responses == 3 );
+    REQUIRE( agent.onReadable(ready.data.fd).packets == 0 );
+    REQUIRE( agent.getSocketStats(&udp)->sent == 3 );
+
+    for(int i = 0; i < 3; i++){
+        struct pollfd pfd = { client, POLLIN, 0 };
+        REQUIRE( poll(&pfd, 1, 1000) == 1 );
+        REQUIRE( recv(client, buf, sizeof(buf), 0) > 0 );
+    }
+
+    SECTION( "Inform timer"){
+        REQUIRE( agent.nextInformTimeout() == -1 );
+        test_millis() = 10000;
+
+        SNMPTrap* inform = new SNMPTrap("public", SNMP_VERSION_2C);
+        inform->setInform(true);
+        inform->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+        inform->setUptimeCallback(new TimestampCallback(new SortableOIDType(".1.3.6.1.2.1.1.3.0"), new uint32_t(10)));
+        inform->setUDP(&polled);
+
+        REQUIRE( agent.sendTrapTo(inform, IPAddress(127, 0, 0, 1), true, 2, 500) != INVALID_SNMP_REQUEST_ID );
+        REQUIRE( polled.sent.size() == 1 );
+        REQUIRE( agent.nextInformTimeout() == 501 );
+
+        // The timeout counts down as time passes, and nothing's resent before it's up
+        test_millis() = 10200;
+        REQUIRE( agent.nextInformTimeout() == 301 );
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 1 );
+
+        test_millis() = 10501;
+        REQUIRE( agent.nextInformTimeout() == 0 );
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 2 );
+        REQUIRE( polled.sent[1] == polled.sent[0] );
+        REQUIRE( agent.nextInformTimeout() == 501 );
+
+        // Out of retries after the second resend, then there's nothing left to wake up for
+        test_millis() = 11002;
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 3 );
+        test_millis() = 11503;
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 3 );
+        REQUIRE( agent.nextInformTimeout() == -1 );
+        test_millis() = 0;
+    }
+
+    SECTION( "Trap tokens refill on the timer"){
+        test_millis() = 20000;
+        SNMPTrap* traps[2];
+        for(int i = 0; i < 2; i++){
+            traps[i] = new SNMPTrap("public", SNMP_VERSION_2C);
+            traps[i]->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2"));
+            traps[i]->setUDP(&polled);
+        }
+
+        // 4 a second, one at a time
+        agent.setTrapRateLimit(4, 1);
+        REQUIRE( agent.queueTrap(traps[0], IPAddress(127, 0, 0, 1)) );
+        REQUIRE( agent.queueTrap(traps[1], IPAddress(127, 0, 0, 1)) );
+        REQUIRE( agent.nextInformTimeout() == 0 );
+
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 1 );
+        REQUIRE( agent.nextInformTimeout() == 250 );
+
+        test_millis() = 20100;
+        REQUIRE( agent.nextInformTimeout() == 150 );
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 1 );
+
+        test_millis() = 20250;
+        REQUIRE( agent.nextInformTimeout() == 0 );
+        agent.onTimer();
+        REQUIRE( polled.sent.size() == 2 );
+        REQUIRE( agent.queuedTraps() == 0 );
+        REQUIRE( agent.nextInformTimeout() == -1 );
+
+        for(auto trap : traps) delete trap;
+        test_millis() = 0;
+    }
+
+    close(epfd);
+    close(client);
+}
+#endif